@@ -23,4 +23,6 @@
 #define ETH_PHY_TYPE        ETH_PHY_IP101
 #define ETH_CLK_MODE        ETH_CLOCK_GPIO0_IN
 
-#include "comETH_MqttT.hpp"
\ No newline at end of file
+#include "eth_MqttT.hpp"
+#define MQTTT_TRANSPORT MqttEmac
+#include "common_MqttT.hpp"
@@ -49,4 +49,6 @@ void finish_chipguy_setup() {
 
 
 
-#include "comETH_MqttT.hpp"
\ No newline at end of file
+#include "eth_MqttT.hpp"
+#define MQTTT_TRANSPORT MqttW5500
+#include "common_MqttT.hpp"
@@ -30,4 +30,6 @@
 #define ETH_SPI_MISO 19
 #define ETH_SPI_MOSI 23
 
-#include "comETH_MqttT.hpp"
\ No newline at end of file
+#include "eth_MqttT.hpp"
+#define MQTTT_TRANSPORT MqttW5500
+#include "common_MqttT.hpp"
@@ -0,0 +1,179 @@
+// Batched publishing for the MQTT templates.
+//
+// Lots of small readings, each published on its own, cost an MQTT header,
+// a TLS record and a TCP segment apiece.  mqtt_batch collects readings
+// instead, for any number of topics, and publishes them together as one
+// envelope to batch_topic ("%s" is the MAC):
+//
+//   void connectedLoop() {
+//     char v[16];
+//     snprintf(v, sizeof(v), "%.2f", read_voltage());
+//     mqtt_batch.add("sensors/%s/voltage", v);
+//   }
+//
+// A batch goes out when the next reading wouldn't fit (MQTTT_BATCH_BYTES),
+// when its first reading is batch_max_age_ms old, or when mqtt_batch.flush()
+// is called.  While the broker isn't reachable readings keep collecting; once
+// the batch is full, add() returns false.  Batches aren't spooled to flash.
+//
+// Call add() from the networking thread (connectedLoop()), as with
+// mqtt_enqueue().
+//
+// Envelope format (integers little-endian, varints unsigned LEB128):
+//
+//   1 byte   version, 1
+//   8 bytes  unix time of the first reading in ms; 0 if the device's clock
+//            wasn't set
+//   1 byte   number of topics, T
+//   T times: 1 byte length, then the topic
+//   then, to the end of the message, one record per reading:
+//     1 byte   topic index (0 .. T-1)
+//     varint   ms since the previous reading (the first: since the base time)
+//     varint   payload length
+//     payload
+//
+// extras/batch_decode.py turns an envelope back into topic/time/payload
+// records.
+
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <sys/time.h>
+#include "topics_MqttT.hpp"
+#include "metrics_MqttT.hpp"
+
+#ifndef MQTTT_BATCH_BYTES
+#define MQTTT_BATCH_BYTES 1024
+#endif
+#ifndef MQTTT_BATCH_TOPICS
+#define MQTTT_BATCH_TOPICS 16
+#endif
+
+// From the core.
+void mqtt_abort_publish();
+
+// Tunable from the sketch.
+uint32_t batch_max_age_ms = 30000;
+const char* batch_topic = "%s/batch";
+
+class MqttBatch {
+public:
+  struct Stats {
+    uint32_t readings;   // added
+    uint32_t envelopes;  // published
+    uint32_t refused;    // add() returned false
+  };
+
+  explicit MqttBatch(PubSubClient& client) : client(client) {}
+
+  bool add(MqttTopic topic, const uint8_t* payload, size_t len) {
+    if (topic == MQTT_NO_TOPIC || strlen(mqtt_topics[topic]) > 255) return refuse();
+    size_t need = 1 + 5 + 5 + len;
+    int slot = topic_slot(topic);
+    if (slot < 0 || used + need > sizeof(records)) {
+      flush();
+      slot = topic_slot(topic);
+      if (slot < 0 || used + need > sizeof(records)) return refuse();
+    }
+
+    uint32_t now = millis();
+    if (n_readings == 0) {
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      // Before SNTP (or whatever sets the clock) the time is near 1970.
+      base_time = tv.tv_sec > 1600000000 ? (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 : 0;
+      first_at = last_at = now;
+    }
+    records[used++] = slot;
+    put_varint(now - last_at);
+    put_varint(len);
+    memcpy(records + used, payload, len);
+    used += len;
+    last_at = now;
+    n_readings++;
+    st.readings++;
+    return true;
+  }
+
+  bool add(MqttTopic topic, const char* value) { return add(topic, (const uint8_t*)value, strlen(value)); }
+  bool add(const char* topic, const char* value) { return add(mqtt_topics.add(topic), value); }
+  bool add(const char* topic, const uint8_t* payload, size_t len) { return add(mqtt_topics.add(topic), payload, len); }
+
+  // Publishes what's collected now.  Returns false if there was something
+  // but it couldn't be sent (it's kept for next time).
+  bool flush() {
+    if (n_readings == 0) return true;
+    if (!client.connected()) return false;
+
+    size_t total = 1 + 8 + 1 + used;
+    for (uint8_t i = 0; i < n_topics; i++) total += 1 + strlen(mqtt_topics[topics[i]]);
+
+    uint32_t t0 = micros();
+    if (!client.beginPublish(withmac(batch_topic), total, false)) return false;
+    uint8_t head[10];
+    head[0] = 1;
+    for (int i = 0; i < 8; i++) head[1 + i] = (uint8_t)(base_time >> (8 * i));
+    head[9] = n_topics;
+    bool written = client.write(head, sizeof(head)) == sizeof(head);
+    for (uint8_t i = 0; i < n_topics && written; i++) {
+      const char* t = mqtt_topics[topics[i]];
+      uint8_t len = strlen(t);
+      written = client.write(&len, 1) == 1 && client.write((const uint8_t*)t, len) == len;
+    }
+    if (written) written = client.write(records, used) == used;
+    if (!written) {
+      // The envelope is half sent; see mqtt_abort_publish() in the core.
+      mqtt_abort_publish();
+      return false;
+    }
+    if (!client.endPublish()) return false;
+
+    mqtt_metrics.pub_us.record(micros() - t0);
+    st.envelopes++;
+    used = 0;
+    n_readings = 0;
+    n_topics = 0;
+    return true;
+  }
+
+  // Called from loop() while online: flushes a batch that has got old.
+  void service() {
+    if (n_readings && (uint32_t)(millis() - first_at) >= batch_max_age_ms) flush();
+  }
+
+  size_t pending() const { return n_readings; }
+  const Stats& stats() const { return st; }
+
+private:
+  int topic_slot(MqttTopic topic) {
+    for (uint8_t i = 0; i < n_topics; i++)
+      if (topics[i] == topic) return i;
+    if (n_topics == MQTTT_BATCH_TOPICS) return -1;
+    topics[n_topics] = topic;
+    return n_topics++;
+  }
+
+  void put_varint(uint32_t v) {
+    while (v >= 0x80) {
+      records[used++] = (uint8_t)(v | 0x80);
+      v >>= 7;
+    }
+    records[used++] = (uint8_t)v;
+  }
+
+  bool refuse() {
+    st.refused++;
+    return false;
+  }
+
+  PubSubClient& client;
+  uint8_t records[MQTTT_BATCH_BYTES];
+  size_t used = 0;
+  MqttTopic topics[MQTTT_BATCH_TOPICS];
+  uint8_t n_topics = 0;
+  uint32_t n_readings = 0;
+  uint64_t base_time = 0;
+  uint32_t first_at = 0, last_at = 0;
+  Stats st = {};
+};
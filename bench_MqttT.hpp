@@ -0,0 +1,185 @@
+// Benchmark mode, compiled in only when the sketch does
+//
+//   #define MQTTT_BENCHMARK
+//
+// before including the board header (or the host build's "make bench").
+// The sketch then runs as usual, and on top of that measures:
+//
+//   1. boot_to_first_publish_ms: from setup() being entered until the
+//      connection is up and its "online" status has been published.
+//   2. publish_us: how long mqttClient.publish() takes, over
+//      MQTTT_BENCH_SAMPLES publishes of MQTTT_BENCH_PAYLOAD bytes to
+//      mqtt_bench_topic, one every MQTTT_BENCH_INTERVAL_MS.
+//   3. reconnect_ms: MQTTT_BENCH_RECONNECTS times, the connection is
+//      dropped from our end (as if the broker had closed it) and the time
+//      until it's back online is measured.
+//   4. encode_ns and encode_bytes: the README's JSON pattern (three floats
+//      through snprintf) against the same JSON from MqttJson and the same
+//      readings written by MqttPayload as CBOR and as MessagePack, averaged
+//      over MQTTT_BENCH_ENCODES each.
+//
+// When done, one line goes to Serial:
+//
+//   MQTTT_BENCH {"boot_to_first_publish_ms":812,"publish_us":{"n":500,...},"reconnect_ms":[...],
+//                "encode_ns":{"json":..,"mqtt_json":..,"cbor":..,"msgpack":..},"encode_bytes":{...}}
+//
+// extras/host/bench.sh runs every example this way against the broker
+// stand-in and collects the lines.
+
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include "payload_MqttT.hpp"
+#include "json_MqttT.hpp"
+
+#ifndef MQTTT_BENCH_SAMPLES
+#define MQTTT_BENCH_SAMPLES 500
+#endif
+#ifndef MQTTT_BENCH_PAYLOAD
+#define MQTTT_BENCH_PAYLOAD 32
+#endif
+#ifndef MQTTT_BENCH_INTERVAL_MS
+#define MQTTT_BENCH_INTERVAL_MS 10
+#endif
+#ifndef MQTTT_BENCH_RECONNECTS
+#define MQTTT_BENCH_RECONNECTS 5
+#endif
+#ifndef MQTTT_BENCH_ENCODES
+#define MQTTT_BENCH_ENCODES 2000
+#endif
+
+const char* mqtt_bench_topic = "mqttt_bench/latency";
+
+namespace mqtt_bench_json {
+MQTT_JSON_FIELD(temperature, float, 1);
+MQTT_JSON_FIELD(humidity, float, 1);
+MQTT_JSON_FIELD(pressure, float, 2);
+typedef MqttJson<temperature, humidity, pressure> Weather;
+}
+
+class MqttBench {
+public:
+  void setup_started() { setup_ms = millis(); }
+
+  // Called at the top of every loop(), online or not.
+  void loop(PubSubClient& mqtt, Client& transport, bool online) {
+    uint32_t now = millis();
+    switch (phase) {
+      case WAIT_ONLINE:
+        if (!online) return;
+        boot_ms = now - setup_ms;
+        next_publish = now;
+        phase = PUBLISHING;
+        return;
+
+      case PUBLISHING: {
+        if (!online || (int32_t)(now - next_publish) < 0) return;
+        next_publish += MQTTT_BENCH_INTERVAL_MS;
+        uint8_t payload[MQTTT_BENCH_PAYLOAD];
+        memset(payload, 'x', sizeof(payload));
+        uint32_t t0 = micros();
+        bool ok = mqtt.publish(mqtt_bench_topic, payload, sizeof(payload), false);
+        uint32_t us = micros() - t0;
+        if (!ok) { failed++; return; }
+        samples[n_samples++] = us;
+        if (n_samples == MQTTT_BENCH_SAMPLES) phase = DROP;
+        return;
+      }
+
+      case DROP:
+        if (!online) return;
+        transport.stop();
+        dropped_at = now;
+        phase = WAIT_DOWN;
+        return;
+
+      case WAIT_DOWN:
+        // The connection state machine notices on its next tick.
+        if (!online) phase = WAIT_BACK;
+        return;
+
+      case WAIT_BACK:
+        if (!online) return;
+        reconnect_ms[n_reconnects++] = now - dropped_at;
+        phase = n_reconnects == MQTTT_BENCH_RECONNECTS ? DONE : DROP;
+        if (phase == DONE) report();
+        return;
+
+      case DONE:
+        return;
+    }
+  }
+
+  bool done() const { return phase == DONE; }
+
+private:
+  enum Phase : uint8_t { WAIT_ONLINE, PUBLISHING, DROP, WAIT_DOWN, WAIT_BACK, DONE };
+
+  void report() {
+    // Insertion sort; a few hundred samples, once.
+    for (uint32_t i = 1; i < n_samples; i++) {
+      uint32_t v = samples[i], j = i;
+      for (; j > 0 && samples[j - 1] > v; j--) samples[j] = samples[j - 1];
+      samples[j] = v;
+    }
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < n_samples; i++) sum += samples[i];
+
+    Serial.printf("MQTTT_BENCH {\"boot_to_first_publish_ms\":%u,", (unsigned)boot_ms);
+    Serial.printf("\"publish_us\":{\"n\":%u,\"failed\":%u,\"min\":%u,\"mean\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u},",
+                  (unsigned)n_samples, (unsigned)failed, (unsigned)samples[0], (unsigned)(sum / n_samples),
+                  (unsigned)percentile(50), (unsigned)percentile(90), (unsigned)percentile(99),
+                  (unsigned)samples[n_samples - 1]);
+    Serial.printf("\"payload_bytes\":%u,\"reconnect_ms\":[", (unsigned)MQTTT_BENCH_PAYLOAD);
+    for (uint32_t i = 0; i < n_reconnects; i++) Serial.printf(i ? ",%u" : "%u", (unsigned)reconnect_ms[i]);
+    Serial.printf("],");
+    report_encode();
+    Serial.printf("}\n");
+  }
+
+  void report_encode() {
+    const char* names[] = {"json", "mqtt_json", "cbor", "msgpack"};
+    uint32_t ns[4];
+    size_t bytes[4];
+    for (int f = 0; f < 4; f++) {
+      size_t total = 0;
+      uint32_t t0 = micros();
+      for (uint32_t i = 0; i < MQTTT_BENCH_ENCODES; i++) {
+        // Readings that change, so nothing is computed once and reused.
+        float temperature = 20 + i * 0.01f, humidity = 40 + i * 0.02f, pressure = 1013 + i * 0.05f;
+        if (f == 0) {
+          total += snprintf(encoded, sizeof(encoded), "{\"temperature\":%.1f,\"humidity\":%.1f,\"pressure\":%.2f}",
+                            temperature, humidity, pressure);
+          continue;
+        }
+        if (f == 1) {
+          total += mqtt_bench_json::Weather::write(encoded, temperature, humidity, pressure);
+          continue;
+        }
+        MqttPayload p((uint8_t*)encoded, sizeof(encoded), f == 2 ? MQTT_CBOR : MQTT_MSGPACK);
+        p.map(3).add("temperature", temperature).add("humidity", humidity).add("pressure", pressure);
+        total += p.size();
+      }
+      ns[f] = (uint64_t)(micros() - t0) * 1000 / MQTTT_BENCH_ENCODES;
+      bytes[f] = total / MQTTT_BENCH_ENCODES;
+    }
+    Serial.printf("\"encode_ns\":{");
+    for (int f = 0; f < 4; f++) Serial.printf("%s\"%s\":%u", f ? "," : "", names[f], (unsigned)ns[f]);
+    Serial.printf("},\"encode_bytes\":{");
+    for (int f = 0; f < 4; f++) Serial.printf("%s\"%s\":%u", f ? "," : "", names[f], (unsigned)bytes[f]);
+    Serial.printf("}");
+  }
+
+  uint32_t percentile(uint32_t p) const { return samples[(n_samples - 1) * p / 100]; }
+
+  Phase phase = WAIT_ONLINE;
+  uint32_t setup_ms = 0, boot_ms = 0, next_publish = 0, dropped_at = 0;
+  uint32_t samples[MQTTT_BENCH_SAMPLES];
+  uint32_t n_samples = 0, failed = 0;
+  uint32_t reconnect_ms[MQTTT_BENCH_RECONNECTS];
+  uint32_t n_reconnects = 0;
+  char encoded[200];  // a member, so the encoders' output isn't optimized away
+};
+
+MqttBench mqtt_bench;
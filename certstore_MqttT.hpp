@@ -0,0 +1,85 @@
+// Trusted CA certificates for the MQTT templates' TLS client.
+//
+// Certificates are parsed once, when added, into mqtt_ca_store and stay
+// parsed; every connection (see tls_MqttT.hpp) verifies against the same
+// store instead of parsing PEM text again.  The store can hold several CAs,
+// e.g. when moving a fleet from one broker certificate to another:
+//
+//   void finish_chipguy_setup() {
+//     mqtt_ca_store.add_pem(ca_cert_new);                 // PEM, one or more certificates
+//     mqtt_ca_store.add_der(ca_old_der, sizeof(ca_old_der)); // or DER, no text parsing at all
+//   }
+//
+// add_der_bundle() takes several DER certificates in one blob, each preceded
+// by its length as two bytes, big-endian; extras/ca_bundle.py turns PEM files
+// into such a blob as a C array.  espClient.setCACert(ca_cert) adds ca_cert
+// here as well.
+//
+// The store's chain is handed to mbedTLS as it is (mbedtls_ssl_conf_ca_chain),
+// so verifying only compares names against certificates parsed long ago.
+// There's no index for finding the issuer: mbedTLS walks the chain, which
+// for the few CAs a device trusts costs little next to the handshake.  An
+// index would need mbedTLS's trusted-CA callback, and mbedTLS frees
+// whatever list that returns, so the candidates would have to be parsed
+// again on every connect.
+
+#pragma once
+
+#include <Arduino.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/ssl.h>
+
+class MqttCertStore {
+public:
+  MqttCertStore() { mbedtls_x509_crt_init(&chain); }
+
+  // One or more PEM certificates.  Returns false if none could be parsed.
+  bool add_pem(const char* pem) {
+    size_t before = n;
+    int rc = mbedtls_x509_crt_parse(&chain, (const unsigned char*)pem, strlen(pem) + 1);
+    changed();
+    return rc >= 0 && n > before;
+  }
+
+  bool add_der(const uint8_t* der, size_t len) {
+    int rc = mbedtls_x509_crt_parse_der(&chain, der, len);
+    changed();
+    return rc == 0;
+  }
+
+  // [2-byte big-endian length][DER certificate], repeated.  Returns how many
+  // were added.
+  int add_der_bundle(const uint8_t* bundle, size_t len) {
+    int added = 0;
+    while (len >= 2) {
+      size_t l = ((size_t)bundle[0] << 8) | bundle[1];
+      if (l > len - 2) break;
+      if (mbedtls_x509_crt_parse_der(&chain, bundle + 2, l) == 0) added++;
+      bundle += 2 + l;
+      len -= 2 + l;
+    }
+    changed();
+    return added;
+  }
+
+  size_t count() const { return n; }
+
+  // Bumped whenever certificates are added, so clients know to pick them up.
+  uint32_t generation() const { return gen; }
+
+  // Points an SSL configuration at the store.
+  void configure(mbedtls_ssl_config* conf) { mbedtls_ssl_conf_ca_chain(conf, &chain, NULL); }
+
+private:
+  void changed() {
+    n = 0;
+    for (const mbedtls_x509_crt* c = &chain; c && c->raw.len; c = c->next) n++;
+    gen++;
+  }
+
+  mbedtls_x509_crt chain;
+  size_t n = 0;
+  uint32_t gen = 0;
+};
+
+MqttCertStore mqtt_ca_store;
@@ -0,0 +1,139 @@
+// Lock-free hand-off between loop1() (or any one task) and connectedLoop().
+//
+// Both of these have exactly one writer and one reader, and neither ever
+// waits: no mutex, so no contention and no priority inversion, and a
+// sensor task can't be held up by a publish that's stuck on a bad link.
+//
+// MqttRing<T, N> is a queue of up to N samples (N a power of two), for when
+// every sample matters:
+//
+//   MqttRing<Sample, 64> samples;
+//
+//   void loop1() {
+//     Sample s = read_sample();
+//     samples.push(s);            // false (and counted) if the ring is full
+//   }
+//   void connectedLoop() {
+//     Sample s;
+//     while (samples.pop(s)) publish_sample(s);
+//   }
+//
+// MqttLatest<T> holds just the newest value, for when only that matters
+// (the SharedVariable pattern in AI_GUIDANCE.md, without the mutex).  set()
+// and getIfChanged() each finish in a fixed number of steps whatever the
+// other side is doing:
+//
+//   MqttLatest<float> temperature;
+//
+//   void loop1()         { temperature.set(readTemperatureSensor()); }
+//   void connectedLoop() { float t; if (temperature.getIfChanged(t)) ...; }
+//
+// T is copied in and out, so keep it a plain struct or number.  The
+// counters and indices each side writes are kept on their own cache line
+// (MQTTT_CACHE_LINE bytes), so the two sides don't keep taking the line from
+// each other.  On chips without atomic instructions (ESP32-C3, -S2) the
+// compiler's atomics are short critical sections; still no waiting on the
+// other task.
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef MQTTT_CACHE_LINE
+#ifdef ESP_PLATFORM
+#define MQTTT_CACHE_LINE 32
+#else
+#define MQTTT_CACHE_LINE 64
+#endif
+#endif
+
+template <class T, size_t N>
+class MqttRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "MqttRing size must be a power of two");
+
+public:
+  // Writer side only.  Returns false, and counts a drop, if the ring is full.
+  bool push(const T& v) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail_seen >= N) {
+      tail_seen = tail.load(std::memory_order_acquire);
+      if (h - tail_seen >= N) {
+        drops.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    slots[h & (N - 1)] = v;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Reader side only.  Returns false if there's nothing waiting.
+  bool pop(T& out) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head_seen) {
+      head_seen = head.load(std::memory_order_acquire);
+      if (t == head_seen) return false;
+    }
+    out = slots[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Either side; a snapshot that may be out of date by the time it's used.
+  size_t size() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  static constexpr size_t capacity() { return N; }
+  uint32_t dropped() const { return drops.load(std::memory_order_relaxed); }
+
+private:
+  // Written by the writer.
+  alignas(MQTTT_CACHE_LINE) std::atomic<uint32_t> head{0};
+  uint32_t tail_seen = 0;
+  std::atomic<uint32_t> drops{0};
+  // Written by the reader.
+  alignas(MQTTT_CACHE_LINE) std::atomic<uint32_t> tail{0};
+  uint32_t head_seen = 0;
+  alignas(MQTTT_CACHE_LINE) T slots[N];
+};
+
+// A triple buffer: the writer fills one slot, the reader reads another, and
+// the third holds the newest finished value.  Handing a slot over is a
+// single atomic exchange.
+template <class T>
+class MqttLatest {
+public:
+  // Writer side only.
+  void set(const T& v) {
+    slots[back].value = v;
+    back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  // Reader side only.  out gets the newest value; returns true if it wasn't
+  // there at the last call (false before the first set()).
+  bool getIfChanged(T& out) {
+    bool fresh = middle.load(std::memory_order_relaxed) & FRESH;
+    if (fresh) front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+    out = slots[front].value;
+    return fresh;
+  }
+
+  // Reader side only.  The newest value, changed or not.
+  T get() {
+    T v;
+    getIfChanged(v);
+    return v;
+  }
+
+private:
+  enum : uint32_t { INDEX = 3, FRESH = 4 };
+  struct alignas(MQTTT_CACHE_LINE) Slot {
+    T value;
+  };
+  Slot slots[3] = {};
+  alignas(MQTTT_CACHE_LINE) std::atomic<uint32_t> middle{1};
+  alignas(MQTTT_CACHE_LINE) uint32_t back = 0;   // the writer's
+  alignas(MQTTT_CACHE_LINE) uint32_t front = 2;  // the reader's
+};
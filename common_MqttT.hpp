@@ -10,31 +10,46 @@
 #include <WiFi.h>
 #include <ArduinoOTA.h>
 
-
-#if ESP_ARDUINO_VERSION_MAJOR >= 3
-#include <esp_eap_client.h>
-#else
-#include <esp_wpa2.h>
-#endif
-
 #include <PubSubClient.h>
+#include "pubqueue_MqttT.hpp"
+#include "storefwd_MqttT.hpp"
+#include "tls_MqttT.hpp"
+#include "topics_MqttT.hpp"
+#include "stream_MqttT.hpp"
+#include "published_MqttT.hpp"
+#include "payload_MqttT.hpp"
+#include "json_MqttT.hpp"
+#include "channel_MqttT.hpp"
+#include "subscribe_MqttT.hpp"
+#include "inbound_MqttT.hpp"
+#include "wire_MqttT.hpp"
+#include "tasks_MqttT.hpp"
+#include "nettask_MqttT.hpp"
+#ifdef MQTTT_BENCHMARK
+#include "bench_MqttT.hpp"
+#endif
 #include <WiFiClientSecure.h>
 #include <esp_task_wdt.h> // Watchdog timer
 
+// How the device gets onto the network, picked at compile time: WiFi
+// (wifi_MqttT.hpp) unless the board header picked one of the Ethernet
+// transports in eth_MqttT.hpp.  A transport is a struct of static functions:
+//
+//   begin()      brings the interface up, in setup(), calling mqtt_identify()
+//                once it knows its MAC
+//   up()         whether the link can carry traffic
+//   reconnect()  called from loop() while it can't; true once it can again
+//
+// Only the chosen one is compiled in.
+#ifndef MQTTT_TRANSPORT
+#include "wifi_MqttT.hpp"
+#define MQTTT_TRANSPORT MqttWifi
+#endif
+typedef MQTTT_TRANSPORT MqttTransport;
+
 extern const char* ARDUINO_OTA_HOSTNAME;
 extern const char* ARDUINO_OTA_PASSWORD;
 
-// WPA2 / WPA2 Enterprise credentials
-extern bool using_WPA2_Enterprise;
-extern const char* ssid;
-extern const char* wifi_username; // Username (applies only to WPA2 Enterprise)
-extern const char* wifi_password; // Password for authentication
-
-// Do scan?
-// recommend true if WiFi might have multiple AP's on same SSID.
-// recommend false if WiFi SSID is likely to be hidden.
-extern bool do_wifi_scan;
-
 // MQTT Broker settings
 extern const char* mqtt_clientid;
 extern const char *last_will_topic;
@@ -55,25 +70,39 @@ const char *watchdog_subscribe_topic = "unix_time/unix_time";
 // SSL/TLS Certificate for MQTT Server (moved to ca_cw_cert.cpp)
 extern const char* ca_cert;
 
-WiFiClientSecure espClient;
-PubSubClient mqttClient(espClient);
+MqttSecureClient espClient;  // MqttTlsClient on ESP32 (see tls_MqttT.hpp)
+MqttWire mqtt_wire(espClient);  // passes everything through (see wire_MqttT.hpp)
+MqttSharedClient mqttClient(mqtt_wire);  // PubSubClient (see nettask_MqttT.hpp)
+MqttSubscriptions mqtt_subscriptions(mqttClient);
 
-bool eth_connected=false;
+// For a publish that was begun but can't be finished: nothing else can be
+// sent on this connection (it would be read as the rest of the message), so
+// the transport is closed under PubSubClient, which notices at its next
+// connected().
+void mqtt_abort_publish() { mqtt_wire.stop(); }
 
 const char *device_status_to_report = "online";
 bool reportable_initialization_failure=false;
 
+// If true, connectedLoop() keeps getting called while the broker can't be
+// reached, so readings taken with mqtt_enqueue() are queued (and spooled to
+// flash, if mqtt_spool_backend() is defined) instead of lost.  Direct
+// mqttClient.publish() calls just fail during that time.
+bool collect_while_offline = false;
+
 // USER-IMPLEMENTABLE FUNCTIONS (weak symbols - define in your .ino file):
 // setup1() - Optional initialization for UI thread (called once on separate thread)
 // loop1() - Optional UI loop running on separate thread
 // connectedLoop() - REQUIRED function called when MQTT is connected
 // set_chipguy_rgb_pixel() - Optional function for custom RGB LED control
 // finish_chipguy_setup() - Optional function called at end of setup()
+// mqtt_spool_backend() - Optional storage for store-and-forward (see storefwd_MqttT.hpp)
 void setup1() __attribute__((weak));
 void loop1() __attribute__((weak));
 void connectedLoop() __attribute__((weak));
 void set_chipguy_rgb_pixel(uint8_t r, uint8_t g, uint8_t b) __attribute__((weak));
 void finish_chipguy_setup() __attribute__((weak));
+MqttStoreBackend* mqtt_spool_backend() __attribute__((weak));
 
 
 volatile uint32_t status_pixel_color;
@@ -83,142 +112,45 @@ void setPixelColor(uint8_t r, uint8_t g, uint8_t b) {
 	if (set_chipguy_rgb_pixel) set_chipguy_rgb_pixel(r,g,b);
 }
 
-bool got_disconnected_event=false;
-
-
-
-
-
-void onWiFiEvent(WiFiEvent_t event) {
-  if (event==ARDUINO_EVENT_WIFI_STA_DISCONNECTED) got_disconnected_event=true;
-  if (event==ARDUINO_EVENT_ETH_DISCONNECTED) got_disconnected_event=true;
-}
-
 void feed_watchdog() { esp_task_wdt_reset(); }
-void setup_wifi() {
-  WiFi.disconnect(true);  // Disconnect any previous WiFi connection
-
-  WiFi.mode(WIFI_STA);    // Set WiFi to station mode
-
-  static bool ran_once;
-  if (!ran_once) WiFi.onEvent(onWiFiEvent);
-  ran_once=true;
-
-  byte best_bssid[6], second_best_bssid[6];
-  byte* selected_bssid = NULL;
-  int32_t best_rssi = -999, second_best_rssi = -999;
-  int32_t selected_channel=0, second_best_channel=0;
-
-  WiFi.setScanMethod(WIFI_ALL_CHANNEL_SCAN);
-
-  if (do_wifi_scan) {
-    // Do the scan.
-    // The default for the "async" parameter is false, so our usage here will block till finished.
-    int n = WiFi.scanNetworks();
-
-    // Consider the SSID for best/secondbest candidacy (assuming encryptionType matches)
-    // Note that if we find nothing (e.g. it's hidden), BSSID will remain null, and the
-    // WiFi library will seek it automatically (without the benefit of best/secondbest)
-    for (int i = 0; i < n; ++i) {
-      if (WiFi.SSID(i)==ssid) {
-        bool ssid_uses_WPA2_Enterprise = (WiFi.encryptionType(i)==WIFI_AUTH_WPA2_ENTERPRISE);
-        if (using_WPA2_Enterprise == ssid_uses_WPA2_Enterprise) {
-          if (WiFi.RSSI(i) > best_rssi) {
-            // Found a new best -- demote any old one to second-best
-            second_best_rssi = best_rssi, second_best_channel = selected_channel;
-            best_rssi = WiFi.RSSI(i), selected_channel = WiFi.channel(i);
-            byte* bssid = WiFi.BSSID(i);
-            for (int k=0; k<6; k++) second_best_bssid[k]=best_bssid[k], best_bssid[k]= bssid[k];
-            selected_bssid = best_bssid;
-          } else if (WiFi.RSSI(i) > second_best_rssi) {
-            // Found a new second-best
-            second_best_rssi = WiFi.RSSI(i), second_best_channel = WiFi.channel(i);
-            byte* bssid = WiFi.BSSID(i);
-            for (int k=0; k<6; k++) second_best_bssid[k]=bssid[k];
-          }
-        }
-      }
-    }
-    Serial.println("WiFi.scanNetworks() completed.");
-  }
-
-  if (using_WPA2_Enterprise) {
-#if ESP_ARDUINO_VERSION_MAJOR >= 3
-    WiFi.begin(ssid, WPA2_AUTH_PEAP, wifi_username, wifi_username, wifi_password, NULL, NULL, NULL, -1, selected_channel, selected_bssid);
-#else
-    esp_wifi_sta_wpa2_ent_set_identity((uint8_t *)wifi_username, strlen(wifi_username));
-    esp_wifi_sta_wpa2_ent_set_username((uint8_t *)wifi_username, strlen(wifi_username));
-    esp_wifi_sta_wpa2_ent_set_password((uint8_t *)wifi_password, strlen(wifi_password));
-    esp_wifi_sta_wpa2_ent_enable(); 
-    WiFi.begin(ssid, NULL, selected_channel, selected_bssid);
-#endif 
-  } else {
-    WiFi.begin(ssid, wifi_password, selected_channel, selected_bssid);
-  }
-
-  int timeoutcounter=30;
-  auto wfs = WiFi.status();
-  static const char* wfs_statuses[] = {"idle","no ssid","scanned","connected","conn fail","conn lost","disconn"};
-	// Serial.print("WiFi status is: ");
-	// ln(wfs_statuses[wfs]);
-
-  while (wfs != WL_CONNECTED) {
-    if (--timeoutcounter < 0) return;
-    if (got_disconnected_event) {
-			// Serial.println("WiFi got disconnected event.");
-    	break;
-    }
-    delay(500);
-    auto new_wfs = WiFi.status();
-    if (new_wfs != wfs) {
-    	// Serial.print("WiFi status is now: ");
-    	// Serial.println(wfs_statuses[new_wfs]);
-    }
-    wfs = new_wfs;
-  }
-  got_disconnected_event=false;
-  if (WiFi.status() != WL_CONNECTED && second_best_rssi != -999) {
-    // Trying alternate (if one identified), or just trying via esp selection (if none)
-    selected_bssid = NULL, selected_channel=0;
-    if (second_best_rssi != -999) selected_bssid = second_best_bssid, selected_channel=second_best_channel;
-    if (using_WPA2_Enterprise) {
-#if ESP_ARDUINO_VERSION_MAJOR >= 3
-      WiFi.begin(ssid, WPA2_AUTH_PEAP, wifi_username, wifi_username, wifi_password, NULL, NULL, NULL, -1, selected_channel, selected_bssid);
-#else
-      WiFi.begin(ssid, NULL, selected_channel, selected_bssid);
-#endif
-    } else WiFi.begin(ssid, wifi_password, selected_channel, selected_bssid);
-    timeoutcounter = 30;
-    wfs = WiFi.status();
-    while (wfs != WL_CONNECTED) {
-      if (--timeoutcounter < 0) return;
-      if (got_disconnected_event) return;
-      delay(500);
-      wfs = WiFi.status();
-    }
-  }
-
-  feed_watchdog(); // feed watchdog timer
-
-  // Serial.print("WiFi connected, local IP ");
-  // Serial.println(WiFi.localIP());
 
+// The device's hostname, for OTA and the network interface:
+// ARDUINO_OTA_HOSTNAME with %s as the MAC, in the same 12 hex digits as the
+// topics.  The transport calls mqtt_identify() as soon as it knows its MAC,
+// which expands the topic table too.
+char mqtt_hostname[64];
+void mqtt_identify(const uint8_t* mac) {
+  if (*mqtt_hostname) return;
+  char macstr[13];
+  snprintf(macstr, sizeof(macstr), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  snprintf(mqtt_hostname, sizeof(mqtt_hostname), ARDUINO_OTA_HOSTNAME, macstr);
+  mqtt_topics.expand(mac, mqtt_hostname);
 }
 
-
-
-
-void callback(char* topic, byte* payload, unsigned int length) {
+void handle_message(char* topic, byte* payload, unsigned int length) {
+  // Handlers registered with mqtt_subscriptions.on() get first go.
+  if (mqtt_subscriptions.dispatch(topic, payload, length)) return;
   Serial.print("Rcvd [");
   Serial.print(topic);
   Serial.print("] ");
-  if (reportable_initialization_failure==false) feed_watchdog(); // Feed watchdog
   for (int i = 0; i < length; i++) Serial.print((char)payload[i]);
   Serial.println();
 }
 
+void callback(char* topic, byte* payload, unsigned int length) {
+  if (reportable_initialization_failure==false) feed_watchdog(); // Feed watchdog
+  // With inbound_mode set, handle_message() runs on another task (see inbound_MqttT.hpp).
+  if (inbound_mode != MQTT_INBOUND_INLINE &&
+      mqtt_inbound.begin(handle_message, inbound_mode == MQTT_INBOUND_TASK || !loop1))
+    mqtt_inbound.offer(topic, payload, length);
+  else handle_message(topic, payload, length);
+}
+
 // Task handle for the new task
 TaskHandle_t myTaskHandle = NULL;
+// The network task, with MQTTT_NET_TASK (see nettask_MqttT.hpp).
+TaskHandle_t net_task = NULL;
+bool network_step();
 /*
 void myTaskFunction(void *parameter) {
   if (setup1) setup1();
@@ -227,7 +159,18 @@ void myTaskFunction(void *parameter) {
 */
 void setup() {
 
+#ifdef MQTTT_BENCHMARK
+  mqtt_bench.setup_started();
+#endif
   Serial.begin(115200);
+  // Before loop1() can add topics or subscriptions.
+  mqtt_topics.share();
+  mqtt_subscriptions.share();
+#ifdef MQTTT_NET_TASK
+  // Before anything (loop1() included) can queue or publish a message.
+  publish_queue.share();
+  mqttClient.share();
+#endif
   
 #if ESP_ARDUINO_VERSION_MAJOR >= 3
   esp_task_wdt_deinit();
@@ -241,6 +184,8 @@ void setup() {
   esp_task_wdt_init(60, true); // enable 60-second watchdog timer
 #endif
   esp_task_wdt_add(NULL);
+
+  if (mqtt_spool_backend) storefwd.begin(mqtt_spool_backend());
   
   
   setPixelColor(0,255,255);
@@ -248,23 +193,22 @@ void setup() {
   if (loop1) {
 
 
-    xTaskCreate(
+    // Core, priority and stack: see tasks_MqttT.hpp.
+    mqtt_start_loop1(
       [](void *parameter) {
         if (setup1) setup1();
-        while (true) loop1();
-      }, // Task function
-      //myTaskFunction,      // Task function
-      "Arduino Task",      // Task name (for debugging)
-      10000,               // Stack size (in words, not bytes)
-      NULL,                // Task input parameter
-      1,                   // Priority of the task
-      &myTaskHandle        // Task handle
+        while (true) {
+          loop1();
+          if (inbound_mode == MQTT_INBOUND_LOOP1) mqtt_inbound.deliver();
+        }
+      },
+      &myTaskHandle
     );
   } else if (setup1) setup1();
 
   setPixelColor(255,0,0);
 
-  setup_wifi();
+  MqttTransport::begin();
 
   setPixelColor(255,255,0);
 
@@ -276,11 +220,6 @@ void setup() {
   // Port defaults to 3232
   // ArduinoOTA.setPort(3232);
 
-  char fullHostname[64];
-  // Using snprintf so that any "%s" in the hostname will be replaced by MAC address
-  snprintf(fullHostname, 64, ARDUINO_OTA_HOSTNAME, WiFi.macAddress().c_str());
-  ArduinoOTA.setHostname(fullHostname);
-
   ArduinoOTA.setPassword(ARDUINO_OTA_PASSWORD);
 
 
@@ -312,81 +251,53 @@ void setup() {
       else if (error == OTA_END_ERROR) Serial.println("End Failed");
     });
 
-	if (*ARDUINO_OTA_PASSWORD) ArduinoOTA.begin();
-
-
 	// call any finish functions if present
 	if (finish_chipguy_setup) finish_chipguy_setup();
 
+#ifdef MQTTT_NET_TASK
+  // From here on the networking runs in its own task, which the watchdog
+  // watches instead of this one.
+  if (mqtt_start_net_task([]() {
+        mqttClient.take();
+        network_step();
+        mqttClient.give();
+      }, &net_task))
+    esp_task_wdt_delete(NULL);
+#endif
+
   Serial.println("setup() has completed.");
 
 }
 
-// Adds the device MAC address to a single string replacing %s, sharing a
-// single common buffer.
-static const char* withmac(const char *str) {
-  // Return any string not containing a percent sign unchanged.
-  const char *p = str;
-  for (; *p; p++) if (*p=='%') break;
-  if (*p==0) return str;
-
-  static char withmac_buffer[256];  
-  uint8_t mac[6];
-  WiFi.macAddress(mac);  // Get MAC address
-  char macstr[20];
-  snprintf(macstr, sizeof(macstr), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-  snprintf(withmac_buffer, sizeof(withmac_buffer), str, macstr, macstr, macstr);
-  return withmac_buffer;
+// Called from loop() whenever the broker isn't reachable.
+void service_offline() {
+  // (With the network task, loop() keeps calling connectedLoop() itself.)
+  if (collect_while_offline && connectedLoop && !net_task) connectedLoop();
+  // Anything queued now would otherwise sit in RAM; put it on flash.
+  storefwd.spill(publish_queue);
 }
 
-void loop() {
+#include "connection_MqttT.hpp"
+MqttConnection<MqttSecureClient> mqtt_connection(mqttClient, espClient);
+#include "batch_MqttT.hpp"
+MqttBatch mqtt_batch(mqttClient);
+#include "qos1_MqttT.hpp"
+MqttQos1 mqtt_qos1(mqttClient, mqtt_wire);
 
-  while (WiFi.status() != WL_CONNECTED) {
-    // LED RED
-    setPixelColor(255,0,0);
+// Nothing waiting to go out or to be acknowledged: a good moment for the
+// transport to reconnect, if it has to.
+bool mqtt_quiet() { return publish_queue.empty() && mqtt_qos1.in_flight() == 0; }
 
-    setup_wifi(); // Reconnect to WiFi if the connection is lost
-    // LED YELLOW
-    setPixelColor(255,255,0);
-
-  }
-
-  if (!mqttClient.connected()) {
-    // LED YELLOW
-    setPixelColor(255,255,0);
-
-    static long last_reconnect_attempt;
-    long l = millis() - last_reconnect_attempt;
-    if (l > 20000 || last_reconnect_attempt==0) {
-      last_reconnect_attempt = l;
-      while (!mqttClient.connected()) {
-        char lwt[100];
-        strlcpy(lwt,withmac(last_will_topic),sizeof(lwt));
-        // try to connect, which will block to return true if connection succeeded, false if failed.
-        if (mqttClient.connect(withmac(mqtt_clientid), mqtt_user, mqtt_password, lwt, 1, true, "offline")) {
-          feed_watchdog(); // feed watchdog timer
-          if (watchdog_subscribe_topic != NULL) mqttClient.subscribe(withmac(watchdog_subscribe_topic));
-          mqttClient.publish(withmac(last_will_topic), device_status_to_report, true);
-        } else {
-          for (int i=0; i<50; i++) {
-            // give time to OTA handler so long as we are struggling with MQTT.
-            ArduinoOTA.handle();
-            if (WiFi.status() != WL_CONNECTED) return;
-            delay(100);
-          }
-        }
-      }
-    }
-  } else {
-    // LED GREEN
-    setPixelColor(0,255,0);
+void loop() {
+#ifdef MQTTT_NET_TASK
+  if (net_task) {
+    // The network task does the rest.
+    if (connectedLoop && (mqtt_connection.state() == MQTT_STATE_ONLINE || collect_while_offline)) connectedLoop();
+    else delay(10);
+    return;
   }
-  
-  if (WiFi.status() != WL_CONNECTED) return;
-  ArduinoOTA.handle();
-  if (!mqttClient.loop()) return;
-
-  if (connectedLoop) connectedLoop();
+#endif
+  if (network_step() && connectedLoop) connectedLoop();
 
   // void connectedLoop() {
   //   bool publish_as_retained = true;
@@ -400,4 +311,67 @@ void loop() {
   // }  
 }
 
+// One pass of the networking: the link, the broker connection, OTA, incoming
+// messages and the publish queue.  True when online, for connectedLoop().
+// Called from loop(), or over and over by the network task.
+bool network_step() {
+
+#ifdef MQTTT_BENCHMARK
+  mqtt_bench.loop(mqttClient, espClient, mqtt_connection.state() == MQTT_STATE_ONLINE);
+#endif
+#ifdef MQTTT_LOOP1_CALIBRATE
+  mqtt_loop1_calibrate(myTaskHandle);
+#endif
+  if (!MqttTransport::up()) {
+    // LED RED
+    setPixelColor(255,0,0);
+    mqtt_connection.tick(false);
+    service_offline();
+
+    // LED YELLOW once the link is back
+    if (MqttTransport::reconnect()) setPixelColor(255,255,0);
+    return false;
+  }
+
+  // OTA starts the first time the link is up.
+  static bool ota_has_started=false;
+  if (ota_has_started==false) {
+    ota_has_started=true;
+    ArduinoOTA.setHostname(mqtt_hostname);
+    if (*ARDUINO_OTA_PASSWORD) ArduinoOTA.begin();
+  }
+
+  // One bounded step towards (or of staying) connected to the broker.
+  mqtt_connection.tick(true);
+  ArduinoOTA.handle();
+
+  if (mqtt_connection.state() != MQTT_STATE_ONLINE) {
+    // LED YELLOW
+    setPixelColor(255,255,0);
+    service_offline();
+    delay(10); // nothing to wait on while backing off; don't spin
+    return false;
+  }
+  // LED GREEN
+  setPixelColor(0,255,0);
+
+  uint32_t loop_started = micros();
+  bool still_connected = mqttClient.loop();
+  mqtt_metrics.loop_us.record(micros() - loop_started);
+  if (!still_connected) {
+    service_offline();
+    return false;
+  }
+
+  // Send whatever mqtt_enqueue() has queued up, within this pass's time budget,
+  // then trickle out anything spooled during an outage.
+  publish_queue.drain(mqttClient, publish_queue_budget_ms);
+  storefwd.replay(mqttClient, storefwd_replay_interval_ms);
+  mqtt_batch.service();
+  mqtt_qos1.service();
+  if (mqtt_metrics.due()) mqtt_metrics.publish(mqttClient, mqtt_connection, withmac(metrics_topic), myTaskHandle);
+
+  return true;
+}
+
 
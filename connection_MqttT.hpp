@@ -0,0 +1,354 @@
+// MQTT connection state machine for the MQTT templates.
+//
+// loop() calls mqtt_connection.tick() once per pass.  Each tick does at most
+// one step of getting connected, and every step that has to wait on the
+// network is bounded by its own timeout, so loop() always comes back within
+// a bounded time and OTA, the publish queue and everything else keep running
+// while the link recovers.
+//
+//   LINK_DOWN -> DNS -> TCP -> TLS -> CONNECT -> SUBSCRIBE -> ANNOUNCE -> ONLINE
+//                 ^                                                      |
+//                 +------------------ BACKOFF <-- (any failure) ---------+
+//
+// The current state is mqtt_connection.state() (mqtt_connection.state_name()
+// for printing), failures are counted per state in mqtt_connection.failures(),
+// and mqtt_connection.stats() has attempts, successes and how long the last
+// (and the longest) outage took to recover from.
+//
+// Retries back off exponentially with "decorrelated jitter": each wait is a
+// random time between mqtt_backoff_min_ms and three times the previous wait,
+// capped at mqtt_backoff_max_ms.  Losing an established connection waits a
+// random 0..mqtt_backoff_min_ms before the first try.  The first attempt
+// after boot, or after the link comes up, doesn't wait at all.  The random
+// numbers are seeded from the MAC, so when a broker restart drops a whole
+// fleet at once, the devices come back spread out instead of all
+// handshaking in lockstep.
+//
+// With MqttTlsClient (tls_MqttT.hpp) the TLS step polls the handshake a bit
+// at a time.  Other transports, WiFiClientSecure included, connect and
+// handshake in one call, so for them the TCP step covers both (bounded by
+// mqtt_tcp_timeout_ms plus mqtt_tls_timeout_ms) and TLS only confirms it.
+//
+// This file is included by the core after its globals; it is
+// not meant to be included on its own.
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <PubSubClient.h>
+#include "tls_MqttT.hpp"
+#include "metrics_MqttT.hpp"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <lwip/dns.h>
+#include <lwip/priv/tcpip_priv.h>
+#endif
+
+enum MqttConnState : uint8_t {
+  MQTT_STATE_LINK_DOWN,  // waiting for WiFi / Ethernet
+  MQTT_STATE_DNS,        // resolving mqtt_server
+  MQTT_STATE_TCP,        // TCP connect
+  MQTT_STATE_TLS,        // TLS handshake
+  MQTT_STATE_CONNECT,    // MQTT CONNECT, waiting for CONNACK
+  MQTT_STATE_SUBSCRIBE,  // (re)subscribing
+  MQTT_STATE_ANNOUNCE,   // publishing device_status_to_report to last_will_topic
+  MQTT_STATE_ONLINE,
+  MQTT_STATE_BACKOFF,    // waiting to try again
+  MQTT_STATE_COUNT
+};
+
+// Per-state timeouts, and the range retry waits are drawn from.  Can be
+// changed from the sketch.
+uint32_t mqtt_dns_timeout_ms = 5000;
+uint32_t mqtt_tcp_timeout_ms = 5000;
+uint32_t mqtt_tls_timeout_ms = 10000;
+uint32_t mqtt_connect_timeout_ms = 5000;
+uint32_t mqtt_backoff_min_ms = 2000;
+uint32_t mqtt_backoff_max_ms = 120000;
+
+// PubSubClient's own socket timeout, in seconds, for every read and publish
+// once connected.  CONNECT waits mqtt_connect_timeout_ms instead, and this
+// is put back afterwards.
+uint16_t mqtt_socket_timeout_s = MQTT_SOCKET_TIMEOUT;
+
+// The TCP and TLS steps for transports that do both in connect().  Connects
+// by name, not by the resolved address, so TLS checks the certificate
+// against the hostname.
+inline void mqtt_set_handshake_timeout(WiFiClientSecure& c, uint32_t ms) { c.setHandshakeTimeout((ms + 999) / 1000); }
+template <class T> static void mqtt_set_handshake_timeout(T&, uint32_t) {}
+
+template <class T>
+static bool mqtt_transport_open(T& c, const char* host, IPAddress, uint16_t port,
+                                uint32_t tcp_timeout_ms, uint32_t tls_timeout_ms) {
+  mqtt_set_handshake_timeout(c, tls_timeout_ms);
+  return c.connect(host, port, (int32_t)tcp_timeout_ms);
+}
+template <class T> static int mqtt_transport_handshake(T& c) { return c.connected() ? 1 : -1; }
+
+template <class Transport>
+class MqttConnection {
+public:
+  struct Stats {
+    uint32_t attempts;          // times a connection attempt was started
+    uint32_t successes;         // times it made it to ONLINE
+    uint32_t last_recovery_ms;  // not-connected to ONLINE, most recent (from boot, the first time)
+    uint32_t max_recovery_ms;
+  };
+
+  MqttConnection(PubSubClient& mqtt, Transport& transport)
+    : mqtt(mqtt), transport(transport), st(MQTT_STATE_LINK_DOWN), entered(0) {
+    memset(fails, 0, sizeof(fails));
+  }
+
+  enum { STATES = MQTT_STATE_COUNT };  // size of failures()
+
+  const Stats& stats() const { return stat; }
+  uint32_t retry_wait() const { return wait; }
+
+  MqttConnState state() const { return st; }
+  const char* state_name() const { return name(st); }
+  uint32_t time_in_state() const { return millis() - entered; }
+  const uint32_t* failures() const { return fails; }
+
+  static const char* name(MqttConnState s) {
+    static const char* const names[MQTT_STATE_COUNT] = {
+      "link down", "dns", "tcp", "tls", "connect", "subscribe", "announce", "online", "backoff"
+    };
+    return s < MQTT_STATE_COUNT ? names[s] : "?";
+  }
+
+  // One step.  link_up says whether WiFi / Ethernet currently has an address.
+  void tick(bool link_up) {
+    if (!link_up) {
+      if (st != MQTT_STATE_LINK_DOWN) {
+        drop();
+        enter(MQTT_STATE_LINK_DOWN);
+      }
+      return;
+    }
+
+    switch (st) {
+      case MQTT_STATE_LINK_DOWN:
+        // Boot, or the link just came up: nothing has failed, so go now.
+        wait = 0;
+        enter(MQTT_STATE_BACKOFF);
+        break;
+
+      case MQTT_STATE_BACKOFF:
+        if (time_in_state() >= wait) {
+          stat.attempts++;
+          attempt_started = millis();
+          enter(MQTT_STATE_DNS);
+        }
+        break;
+
+      case MQTT_STATE_DNS:
+        // The lookup runs in the background; this just polls it.  The answer
+        // also lands in lwIP's cache, so the connect below doesn't ask again.
+        if (!dns_start()) fail();
+        else if (dns_result == DNS_OK) {
+          transport_started = millis();
+          enter(MQTT_STATE_TCP);
+        }
+        else if (dns_result == DNS_FAILED || time_in_state() >= mqtt_dns_timeout_ms) fail();
+        break;
+
+      case MQTT_STATE_TCP:
+        if (mqtt_transport_open(transport, mqtt_server, broker_ip, mqtt_port, mqtt_tcp_timeout_ms, mqtt_tls_timeout_ms))
+          enter(MQTT_STATE_TLS);
+        else fail();
+        break;
+
+      case MQTT_STATE_TLS: {
+        int r = mqtt_transport_handshake(transport);
+        if (r > 0) {
+          mqtt_metrics.hs_ms.record(millis() - transport_started);
+          enter(MQTT_STATE_CONNECT);
+        }
+        else if (r < 0 || time_in_state() >= mqtt_tls_timeout_ms) fail();
+        break;
+      }
+
+      case MQTT_STATE_CONNECT: {
+        // The transport is already up, so PubSubClient only sends CONNECT and
+        // waits (up to its socket timeout) for CONNACK.
+        mqtt.setSocketTimeout((mqtt_connect_timeout_ms + 999) / 1000);
+        bool ok = mqtt.connect(withmac(mqtt_clientid), mqtt_user, mqtt_password, withmac(last_will_topic), 1, true, "offline");
+        mqtt.setSocketTimeout(mqtt_socket_timeout_s);
+        if (ok) {
+          feed_watchdog();
+          enter(MQTT_STATE_SUBSCRIBE);
+        } else fail();
+        break;
+      }
+
+      case MQTT_STATE_SUBSCRIBE:
+        // An MQTT 5 session the broker kept still has the subscriptions.
+        if ((mqtt_wire.session_present() && !mqtt_subscriptions.unsent()) ||
+            ((watchdog_subscribe_topic == NULL || mqtt.subscribe(withmac(watchdog_subscribe_topic))) &&
+             mqtt_subscriptions.resubscribe()))
+          enter(MQTT_STATE_ANNOUNCE);
+        else fail();
+        break;
+
+      case MQTT_STATE_ANNOUNCE: {
+        uint32_t t0 = micros();
+        if (mqtt.publish(withmac(last_will_topic), device_status_to_report, true)) {
+          mqtt_metrics.pub_us.record(micros() - t0);
+          mqtt_metrics.conn_ms.record(millis() - attempt_started);
+          online();
+        } else fail();
+        break;
+      }
+
+      case MQTT_STATE_ONLINE:
+        if (!mqtt.connected()) {
+          drop();
+          down_since = millis();
+          backoff(false);
+        } else mqtt_subscriptions.send_added();
+        break;
+
+      default:
+        backoff(false);
+        break;
+    }
+  }
+
+private:
+  void enter(MqttConnState s) {
+    st = s;
+    entered = millis();
+    if (s == MQTT_STATE_DNS) dns_result = DNS_IDLE, dns_started = false;
+  }
+
+  void fail() {
+    fails[st]++;
+    Serial.print("MQTT connect failed at ");
+    Serial.println(state_name());
+    drop();
+    backoff(true);
+  }
+
+  // Closes the transport and lets PubSubClient see that it's gone;
+  // otherwise it still thinks it's connected, and its next connect() on a
+  // fresh transport returns without sending CONNECT.
+  void drop() {
+    transport.stop();
+    mqtt.connected();
+  }
+
+  void online() {
+    stat.successes++;
+    stat.last_recovery_ms = millis() - down_since;
+    if (stat.last_recovery_ms > stat.max_recovery_ms) stat.max_recovery_ms = stat.last_recovery_ms;
+    sleep = 0;
+    enter(MQTT_STATE_ONLINE);
+  }
+
+  // Picks the wait before the next attempt and goes to BACKOFF.
+  void backoff(bool after_failure) {
+    uint32_t lo = mqtt_backoff_min_ms, hi = mqtt_backoff_max_ms < lo ? lo : mqtt_backoff_max_ms;
+    if (!after_failure) {
+      wait = random_between(0, lo);
+    } else {
+      uint64_t up = sleep ? (uint64_t)sleep * 3 : lo;
+      sleep = random_between(lo, up > hi ? hi : (uint32_t)up);
+      wait = sleep;
+    }
+    enter(MQTT_STATE_BACKOFF);
+  }
+
+  // xorshift32, seeded from the MAC on first use.
+  uint32_t random_between(uint32_t lo, uint32_t hi) {
+    if (rng == 0) {
+      uint8_t mac[6];
+      WiFi.macAddress(mac);
+      rng = 2166136261u;  // FNV-1a over the MAC
+      for (int i = 0; i < 6; i++) rng = (rng ^ mac[i]) * 16777619u;
+      if (rng == 0) rng = 1;
+    }
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return hi <= lo ? lo : lo + rng % (hi - lo + 1);
+  }
+
+  enum { DNS_IDLE, DNS_PENDING, DNS_OK, DNS_FAILED };
+
+  // Kicks off the lookup of mqtt_server the first time it's called in each
+  // visit to the DNS state.  Returns false if it couldn't even be started.
+  bool dns_start() {
+    if (dns_started) return true;
+    dns_started = true;
+    if (broker_ip.fromString(mqtt_server)) {
+      dns_result = DNS_OK;
+      return true;
+    }
+#if defined(ARDUINO_ARCH_ESP32)
+    // Same approach as WiFi.hostByName(), minus the wait: lwIP wants
+    // dns_gethostbyname() called from its own thread.
+    dns_result = DNS_PENDING;
+    dns_gen++;
+    dns_msg.self = this;
+    dns_msg.gen = dns_gen;
+    err_t err = tcpip_api_call(dns_call, &dns_msg.call);
+    if (err == ERR_OK) {
+      broker_ip = IPAddress(ip_2_ip4(&dns_msg.addr)->addr);
+      dns_result = DNS_OK;
+    } else if (err != ERR_INPROGRESS) dns_result = DNS_FAILED;
+    return dns_result != DNS_FAILED;
+#else
+    // No lwIP underneath (host builds): plain blocking lookup.
+    dns_result = WiFi.hostByName(mqtt_server, broker_ip) ? DNS_OK : DNS_FAILED;
+    return true;
+#endif
+  }
+
+#if defined(ARDUINO_ARCH_ESP32)
+  struct DnsMsg {
+    struct tcpip_api_call_data call;
+    MqttConnection* self;
+    uint32_t gen;
+    ip_addr_t addr;
+  };
+
+  static err_t dns_call(struct tcpip_api_call_data* call) {
+    DnsMsg* m = (DnsMsg*)call;
+    return dns_gethostbyname(mqtt_server, &m->addr, dns_found, (void*)(uintptr_t)m->gen);
+  }
+
+  // Runs in the lwIP thread.  Answers to a lookup we've since given up on
+  // (different generation) are ignored.
+  static void dns_found(const char*, const ip_addr_t* addr, void* arg) {
+    MqttConnection* self = dns_msg.self;
+    if (!self || (uint32_t)(uintptr_t)arg != self->dns_gen) return;
+    if (addr) self->broker_ip = IPAddress(ip_2_ip4(addr)->addr);
+    self->dns_result = addr ? DNS_OK : DNS_FAILED;
+  }
+
+  static DnsMsg dns_msg;
+  volatile uint32_t dns_gen = 0;
+#endif
+
+  PubSubClient& mqtt;
+  Transport& transport;
+  MqttConnState st;
+  uint32_t entered;
+  uint32_t fails[MQTT_STATE_COUNT];
+  Stats stat = {};
+  uint32_t wait = 0;        // current BACKOFF lasts this long
+  uint32_t sleep = 0;       // last failure backoff, 0 after success
+  uint32_t down_since = 0;
+  uint32_t attempt_started = 0, transport_started = 0;  // for mqtt_metrics
+  uint32_t rng = 0;
+  IPAddress broker_ip;
+  volatile uint8_t dns_result = DNS_IDLE;
+  bool dns_started = false;
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+template <class Transport>
+typename MqttConnection<Transport>::DnsMsg MqttConnection<Transport>::dns_msg;
+#endif
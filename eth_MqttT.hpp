@@ -0,0 +1,143 @@
+// The Ethernet transports for the core (see common_MqttT.hpp):
+//
+//   MqttEmac    the ESP32's internal Ethernet MAC, with the PHY the
+//               ETH_PHY_* macros describe (the PoESP32)
+//   MqttW5500   a WIZnet W5500 on SPI: ETH_PHY_* plus the ETH_SPI_SCK,
+//               ETH_SPI_MISO and ETH_SPI_MOSI pins (the M5Stack bases)
+//
+// A board header defines the pins, includes this, and picks one:
+//
+//   #define ETH_PHY_TYPE ETH_PHY_IP101
+//   ...
+//   #include "eth_MqttT.hpp"
+//   #define MQTTT_TRANSPORT MqttEmac
+//   #include "common_MqttT.hpp"
+//
+// ETH.h takes its defaults from the ETH_PHY_* macros, so they come first.
+// Define ETH_PHY_CHIPGUY_RESET as a pin to pulse it low before starting the
+// PHY.
+
+#pragma once
+
+#include <WiFi.h>
+#include "ETH.h"
+#ifdef ETH_SPI_SCK
+#include <SPI.h>
+#endif
+
+// From the core.
+void feed_watchdog();
+void mqtt_identify(const uint8_t* mac);
+extern char mqtt_hostname[];
+
+bool eth_connected=false;
+char MyEthMac[30];
+char MyEthIP[30];
+
+void onEthEvent(WiFiEvent_t event) {
+  switch (event) {
+    case ARDUINO_EVENT_ETH_START:
+      Serial.println("ETH Started");
+      //set eth hostname here
+      uint8_t macbytes[6];
+      mqtt_identify(ETH.macAddress(macbytes));
+      ETH.setHostname(mqtt_hostname);
+      break;
+    case ARDUINO_EVENT_ETH_CONNECTED:
+      Serial.println("ETH Connected");
+      break;
+    case ARDUINO_EVENT_ETH_GOT_IP:
+      Serial.print("ETH MAC: ");
+      Serial.print(ETH.macAddress());
+      strcpy(MyEthMac, ETH.macAddress().c_str());
+      Serial.print(", IPv4: ");
+      Serial.print(ETH.localIP());
+      strcpy(MyEthIP, ETH.localIP().toString().c_str());
+      if (ETH.fullDuplex()) Serial.print(", FULL_DUPLEX");
+      Serial.print(", ");
+      Serial.print(ETH.linkSpeed());
+      Serial.println("Mbps");
+      eth_connected = true;
+      break;
+    case ARDUINO_EVENT_ETH_DISCONNECTED:
+      Serial.println("ETH Disconnected");
+      eth_connected = false;
+      break;
+    case ARDUINO_EVENT_ETH_STOP:
+      Serial.println("ETH Stopped");
+      eth_connected = false;
+      break;
+    default:
+      break;
+  }
+}
+
+// What the two have in common: the events, the wait for a link in setup(),
+// and the link coming back by itself.
+struct MqttEthernet {
+  static bool up() { return eth_connected; }
+
+  static bool reconnect() {
+    delay(10);
+    return eth_connected;
+  }
+
+protected:
+  static void prepare() {
+#ifdef ETH_PHY_CHIPGUY_RESET
+    pinMode(ETH_PHY_CHIPGUY_RESET, OUTPUT);
+    digitalWrite(ETH_PHY_CHIPGUY_RESET, HIGH);
+    delay(250);
+    digitalWrite(ETH_PHY_CHIPGUY_RESET, LOW);
+    delay(50);
+    digitalWrite(ETH_PHY_CHIPGUY_RESET, HIGH);
+    delay(350);
+#endif
+    static bool ran_once;
+    if (!ran_once) WiFi.onEvent(onEthEvent);
+    ran_once=true;
+  }
+
+  static void wait_for_link() {
+    // In case the start event came and went before we were listening.
+    uint8_t mac[6];
+    mqtt_identify(ETH.macAddress(mac));
+
+    while (ETH.linkUp()==0) {
+      Serial.print(".");
+      delay(500);
+    }
+
+    for (int i=0; i<20; i++) {
+      auto xip = ETH.localIP();
+      if (xip[0]>0) break;
+      delay(500);
+    }
+
+    feed_watchdog(); // feed watchdog timer
+
+    Serial.println("");
+    Serial.print("Local IP: ");
+    Serial.println(ETH.localIP());
+  }
+};
+
+struct MqttEmac : MqttEthernet {
+  static void begin() {
+    prepare();
+    //ETH.begin(ETH_PHY_TYPE, ETH_PHY_ADDR, ETH_PHY_POWER, ETH_PHY_MDC, ETH_PHY_MDIO,  ETH_CLK_MODE);
+    ETH.begin();
+    wait_for_link();
+  }
+};
+
+#ifdef ETH_SPI_SCK
+struct MqttW5500 : MqttEthernet {
+  static void begin() {
+    prepare();
+    SPI.begin(ETH_SPI_SCK, ETH_SPI_MISO, ETH_SPI_MOSI);
+    ETH.begin(ETH_PHY_TYPE, ETH_PHY_ADDR, ETH_PHY_CS, ETH_PHY_IRQ, ETH_PHY_RST, SPI, ETH_PHY_SPI_FREQ_MHZ);
+    wait_for_link();
+  }
+};
+#endif
@@ -144,6 +144,10 @@ void loop1() {
 }
 
 
+// Topic patterns are expanded once (%s = MAC address) when the network comes up,
+// then published to by handle.
+MqttTopic hello_topic = mqtt_topics.add("hello_world_%s/hello");
+
 // connectedLoop() is a mandatory definition which gets called repeatedly, using
 // the first thread, from the MQTT client thread's main loop, but only while the MQTT server is
 /// connected.  It should publish sensor data to the MQTT server.
@@ -158,13 +162,9 @@ void connectedLoop() {
   static int last_myvalue_published=0;
   static long myvalue_millis;
   if ((long)millis() - myvalue_millis > 10000) {
-    uint8_t mac[6];
-    WiFi.macAddress(mac);  // Get MAC address
-    char hello_topic[40];
-    snprintf(hello_topic, sizeof(hello_topic), "hello_world_%02X%02X%02X%02X%02X%02X/hello", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     char myvalue_str[30];
     sprintf(myvalue_str, "myvalue-%d",last_myvalue_published+1);
-    bool success = mqttClient.publish(hello_topic, myvalue_str, publish_as_retained);
+    bool success = mqttClient.publish(mqtt_topics[hello_topic], myvalue_str, publish_as_retained);
     if (success) last_myvalue_published++, myvalue_millis=millis();
     if (success) feed_watchdog();
   }
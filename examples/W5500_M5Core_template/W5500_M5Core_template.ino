@@ -110,8 +110,10 @@ const char* ca_cert = \
 
 
 
-char *hello_topic_ptr=NULL;
-char hello_topic_buffer[50];
+// Topic patterns are expanded once (%s = MAC address) when the network comes up,
+// then published to by handle.
+MqttTopic hello_topic = mqtt_topics.add("hello_world_%s/hello");
+bool hello_published = false;
 
 
 // If setup1 exists, then it will be called using the 2nd core/thread prior to
@@ -141,7 +143,7 @@ void loop1() {
   tft.setCursor(0,0);
   tft.setTextColor(tft.color24to16(status_pixel_color), 0, true);
   tft.println("network");
-  if (hello_topic_ptr) tft.println(hello_topic_ptr);
+  if (hello_published) tft.println(mqtt_topics[hello_topic]);
   delay(200);
 #endif
 
@@ -164,20 +166,17 @@ void connectedLoop() {
   static int last_myvalue_published=0;
   static long myvalue_millis;
   if ((long)millis() - myvalue_millis > 10000) {
-    uint8_t mac[6];
-    WiFi.macAddress(mac);  // Get MAC address
-    snprintf(hello_topic_buffer, sizeof(hello_topic_buffer), "hello_world_%02X%02X%02X%02X%02X%02X/hello", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    hello_topic_ptr = hello_topic_buffer;
     char myvalue_str[30];
     sprintf(myvalue_str, "myvalue-%d",last_myvalue_published+1);
-    bool success = mqttClient.publish(hello_topic_buffer, myvalue_str, publish_as_retained);
+    bool success = mqttClient.publish(mqtt_topics[hello_topic], myvalue_str, publish_as_retained);
     if (success) {
       last_myvalue_published++, myvalue_millis=millis();
+      hello_published = true;
       feed_watchdog();
       Serial.print("Successfully published ");
       Serial.print(myvalue_str);
       Serial.print(" to ");
-      Serial.println(hello_topic_buffer);
+      Serial.println(mqtt_topics[hello_topic]);
     }
   }
 }
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# Decodes the envelopes mqtt_batch publishes (see batch_MqttT.hpp) into one
+# JSON object per reading:
+#
+#   python3 batch_decode.py envelope.bin
+#
+#   {"topic": "sensors/A1B2C3D4E5F6/voltage", "time_ms": 1792195878123, "payload": "3.30"}
+#
+# time_ms is unix time in ms when the device's clock was set, otherwise ms
+# relative to the first reading in the envelope (and "relative": true).
+# From other code: decode(envelope_bytes) returns the same as a list of dicts,
+# with the payload as bytes.
+
+import json
+import sys
+
+
+class EnvelopeError(ValueError):
+    pass
+
+
+def _varint(buf, pos):
+    value = shift = 0
+    while True:
+        if pos >= len(buf):
+            raise EnvelopeError("truncated varint")
+        b = buf[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+
+
+def decode(buf):
+    if len(buf) < 10:
+        raise EnvelopeError("too short")
+    if buf[0] != 1:
+        raise EnvelopeError("unknown version %d" % buf[0])
+    base = int.from_bytes(buf[1:9], "little")
+    ntopics = buf[9]
+    pos = 10
+    topics = []
+    for _ in range(ntopics):
+        if pos >= len(buf):
+            raise EnvelopeError("truncated topic table")
+        n = buf[pos]
+        topics.append(bytes(buf[pos + 1:pos + 1 + n]).decode("utf-8"))
+        pos += 1 + n
+    out = []
+    t = base
+    while pos < len(buf):
+        index = buf[pos]
+        if index >= ntopics:
+            raise EnvelopeError("topic index %d out of range" % index)
+        delta, pos = _varint(buf, pos + 1)
+        length, pos = _varint(buf, pos)
+        if pos + length > len(buf):
+            raise EnvelopeError("truncated payload")
+        t += delta
+        record = {"topic": topics[index], "time_ms": t, "payload": bytes(buf[pos:pos + length])}
+        if base == 0:
+            record["relative"] = True
+        out.append(record)
+        pos += length
+    return out
+
+
+def main(paths):
+    if not paths:
+        sys.exit("usage: batch_decode.py envelope.bin [...]   ('-' reads stdin)")
+    for path in paths:
+        data = sys.stdin.buffer.read() if path == "-" else open(path, "rb").read()
+        for record in decode(data):
+            record["payload"] = record["payload"].decode("utf-8", "replace")
+            print(json.dumps(record))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+# Converts PEM CA certificates into a C array for mqtt_ca_store.add_der_bundle().
+#
+#   python3 ca_bundle.py my_ca.pem other_ca.pem > ca_bundle.h
+#
+# Every certificate found in the input files goes into the bundle as
+# [2-byte big-endian length][DER], so the device never has to parse PEM text.
+# In the sketch:
+#
+#   #include "ca_bundle.h"
+#   ...
+#   mqtt_ca_store.add_der_bundle(mqtt_ca_bundle, sizeof(mqtt_ca_bundle));
+
+import base64
+import re
+import sys
+
+PEM_RE = re.compile(r"-----BEGIN CERTIFICATE-----(.*?)-----END CERTIFICATE-----", re.S)
+
+
+def main(paths):
+    if not paths:
+        sys.exit("usage: ca_bundle.py cert.pem [more.pem ...]")
+    blob = bytearray()
+    count = 0
+    for path in paths:
+        with open(path) as f:
+            for body in PEM_RE.findall(f.read()):
+                der = base64.b64decode("".join(body.split()))
+                if len(der) > 0xFFFF:
+                    sys.exit("%s: certificate too large" % path)
+                blob += len(der).to_bytes(2, "big") + der
+                count += 1
+    if count == 0:
+        sys.exit("no certificates found")
+
+    out = sys.stdout
+    out.write("// Generated by extras/ca_bundle.py from %s: %d certificate(s)\n" % (", ".join(paths), count))
+    out.write("#pragma once\n\n")
+    out.write("const uint8_t mqtt_ca_bundle[%d] = {\n" % len(blob))
+    for i in range(0, len(blob), 16):
+        out.write("  " + " ".join("0x%02x," % b for b in blob[i:i + 16]) + "\n")
+    out.write("};\n")
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
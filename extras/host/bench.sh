@@ -0,0 +1,34 @@
+#!/bin/sh
+# Runs the benchmark build of each example (see bench_MqttT.hpp) against a
+# local broker stand-in and prints one JSON line per example, tagged with
+# the library version, e.g. to append to a results file and compare across
+# versions:
+#
+#   PUBSUBCLIENT_DIR=~/Arduino/libraries/PubSubClient/src ./bench.sh >> results.jsonl
+#
+# BENCH_PORT (default 18883) is the port the broker stand-in listens on;
+# BENCH_TIMEOUT (default 120) is how long one example may take, in seconds.
+set -e
+cd "$(dirname "$0")"
+
+make -s bench >&2
+port=${BENCH_PORT:-18883}
+version=$(sed -n 's/^version=//p' ../../library.properties)
+nvs=$(mktemp -d)
+
+build/broker_standin -p "$port" >/dev/null &
+broker=$!
+trap 'kill $broker 2>/dev/null; rm -rf "$nvs"' EXIT
+sleep 0.2
+
+for sketch in build/bench/*_template; do
+  example=$(basename "$sketch")
+  rm -rf "$nvs"/*
+  line=$(MQTTT_HOST_BROKER=127.0.0.1:$port MQTTT_HOST_NVS=$nvs timeout "${BENCH_TIMEOUT:-120}" "$sketch" 2>/dev/null |
+         sed -n '/^MQTTT_BENCH /{s/^MQTTT_BENCH {//p;q}') || true
+  if [ -z "$line" ]; then
+    echo "$example: no result" >&2
+    continue
+  fi
+  echo "{\"example\":\"$example\",\"version\":\"$version\",$line"
+done
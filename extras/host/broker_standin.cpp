@@ -0,0 +1,308 @@
+// Minimal MQTT 3.1.1 (and 5) broker stand-in for the host build.
+//
+// Good enough to exercise the template core on a PC: accepts any CONNECT,
+// routes PUBLISH to matching subscriptions (with + and # wildcards, QoS 0
+// delivery), acknowledges QoS 1 publishes, answers PINGREQ, and publishes
+// the current unix time to unix_time/unix_time once a second so the
+// template's watchdog subscription is fed.  Retained messages are kept.
+//
+// MQTT 5 clients get a Topic Alias Maximum of 10 in CONNACK, and when they
+// ask for a session expiry and don't set Clean Start, their subscriptions
+// are kept (until the stand-in exits) and CONNACK says the session is
+// present.
+//
+//   broker_standin [-p port] [-d drop_every_ms] [-v]
+//
+// -d closes every client connection periodically, to measure reconnects.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+struct Conn {
+  int fd;
+  std::string in;
+  std::vector<std::string> filters;
+  bool connected;
+  bool v5;
+  std::string session;  // client id, if the session outlives the connection
+  std::map<unsigned, std::string> aliases;
+};
+
+static std::vector<Conn> conns;
+static std::map<std::string, std::vector<std::string> > sessions;  // client id -> filters
+static std::map<std::string, std::string> retained;
+static bool verbose;
+
+static long now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static bool topic_matches(const std::string& filter, const std::string& topic) {
+  size_t f = 0, t = 0;
+  while (f < filter.size()) {
+    if (filter[f] == '#') return true;
+    // "a/#" also matches "a" itself
+    if (t == topic.size() && filter.compare(f, std::string::npos, "/#") == 0) return true;
+    if (filter[f] == '+') {
+      while (t < topic.size() && topic[t] != '/') t++;
+      f++;
+    } else {
+      if (t >= topic.size() || filter[f] != topic[t]) return false;
+      f++, t++;
+      continue;
+    }
+  }
+  return t == topic.size();
+}
+
+static void send_packet(Conn& c, uint8_t header, const std::string& body) {
+  std::string out(1, (char)header);
+  size_t len = body.size();
+  do {
+    uint8_t d = len & 127;
+    len >>= 7;
+    if (len) d |= 128;
+    out += (char)d;
+  } while (len);
+  out += body;
+  if (send(c.fd, out.data(), out.size(), MSG_NOSIGNAL) < 0) close(c.fd), c.fd = -1;
+}
+
+static std::string mqtt_str(const std::string& s) {
+  return std::string(1, (char)(s.size() >> 8)) + (char)(s.size() & 0xFF) + s;
+}
+
+static std::string u16_str(unsigned v) { return std::string(1, (char)(v >> 8)) + (char)(v & 0xFF); }
+
+// An MQTT 5 PUBLISH has (empty) properties after the topic.
+static std::string publish_body(const Conn& c, const std::string& topic, const std::string& payload) {
+  return mqtt_str(topic) + (c.v5 ? std::string(1, '\0') : "") + payload;
+}
+
+static void deliver(const std::string& topic, const std::string& payload, bool retain) {
+  if (retain) {
+    if (payload.empty()) retained.erase(topic);
+    else retained[topic] = payload;
+  }
+  for (auto& c : conns) {
+    if (c.fd < 0 || !c.connected) continue;
+    for (auto& f : c.filters)
+      if (topic_matches(f, topic)) {
+        send_packet(c, 0x30, publish_body(c, topic, payload));
+        break;
+      }
+  }
+}
+
+// Returns false if the connection should be dropped.
+static bool handle_packet(Conn& c, uint8_t header, const std::string& b) {
+  uint8_t type = header >> 4;
+  size_t p = 0;
+  auto u16 = [&](void) -> unsigned { unsigned v = ((uint8_t)b[p] << 8) | (uint8_t)b[p + 1]; p += 2; return v; };
+  auto str = [&](void) -> std::string { unsigned n = u16(); std::string s = b.substr(p, n); p += n; return s; };
+  auto varint = [&](void) -> size_t {
+    size_t v = 0;
+    for (int shift = 0; p < b.size(); shift += 7) {
+      uint8_t d = b[p++];
+      v |= (size_t)(d & 127) << shift;
+      if (!(d & 128)) break;
+    }
+    return v;
+  };
+  if (!c.connected && type != 1) return false;
+  switch (type) {
+    case 1: {  // CONNECT
+      std::string proto = str();
+      uint8_t level = b[p++];
+      if (proto != "MQTT" || (level != 4 && level != 5)) {
+        send_packet(c, 0x20, std::string("\0\1", 2));
+        return false;
+      }
+      uint8_t flags = b[p++];
+      p += 2;  // keep alive
+      unsigned long expiry = 0;
+      if (level == 5) {
+        size_t end = varint();
+        end += p;
+        while (p < end) {
+          uint8_t id = b[p++];
+          if (id == 0x11) expiry = (unsigned long)u16() << 16, expiry |= u16();
+          else if (id == 0x21 || id == 0x22 || id == 0x23) p += 2;
+          else if (id == 0x27) p += 4;
+          else if (id == 0x17 || id == 0x19) p++;
+          else if (id == 0x26) str(), str();
+          else str();
+        }
+      }
+      std::string client_id = str();
+      c.connected = true;
+      c.v5 = level == 5;
+      bool present = false;
+      if (c.v5) {
+        if (flags & 0x02) sessions.erase(client_id);
+        else if (sessions.count(client_id)) c.filters = sessions[client_id], present = true;
+        if (expiry) c.session = client_id;
+        // session present, success, properties: Topic Alias Maximum 10
+        send_packet(c, 0x20, std::string(1, (char)present) + std::string("\0\3\x22\0\x0A", 5));
+      } else send_packet(c, 0x20, std::string("\0\0", 2));
+      if (verbose) printf("CONNECT fd=%d%s%s\n", c.fd, c.v5 ? " v5" : "", present ? " (session present)" : "");
+      return true;
+    }
+    case 3: {  // PUBLISH
+      std::string topic = str();
+      unsigned qos = (header >> 1) & 3, pid = 0, alias = 0;
+      if (qos) pid = u16();
+      if (c.v5) {
+        size_t end = varint();
+        end += p;
+        while (p < end) {
+          uint8_t id = b[p++];
+          if (id == 0x23) alias = u16();
+          else if (id == 0x01) p++;
+          else if (id == 0x02) p += 4;
+          else if (id == 0x0B) varint();
+          else if (id == 0x26) str(), str();
+          else str();
+        }
+        if (alias && topic.empty()) {
+          if (!c.aliases.count(alias)) return false;  // Topic Alias invalid
+          topic = c.aliases[alias];
+        } else if (alias) c.aliases[alias] = topic;
+      }
+      if (verbose) printf("PUBLISH %s%s%s %.*s\n", topic.c_str(), (header & 1) ? " (retained)" : "",
+                          alias ? (" (alias " + std::to_string(alias) + ")").c_str() : "",
+                          (int)std::min<size_t>(b.size() - p, 60), b.data() + p);
+      deliver(topic, b.substr(p), header & 1);
+      if (qos == 1) send_packet(c, 0x40, u16_str(pid));
+      return true;
+    }
+    case 8: {  // SUBSCRIBE
+      unsigned pid = u16();
+      if (c.v5) p += varint();  // properties
+      std::string codes;
+      while (p < b.size()) {
+        std::string filter = str();
+        codes += (char)(b[p++] & 1);
+        c.filters.push_back(filter);
+        if (!c.session.empty()) sessions[c.session].push_back(filter);
+        if (verbose) printf("SUBSCRIBE %s\n", filter.c_str());
+        for (auto& r : retained)
+          if (topic_matches(filter, r.first)) send_packet(c, 0x31, publish_body(c, r.first, r.second));
+      }
+      send_packet(c, 0x90, u16_str(pid) + (c.v5 ? std::string(1, '\0') : "") + codes);
+      return true;
+    }
+    case 10: {  // UNSUBSCRIBE
+      unsigned pid = u16();
+      if (c.v5) p += varint();  // properties
+      std::string codes;
+      while (p < b.size()) {
+        std::string filter = str();
+        for (size_t i = 0; i < c.filters.size(); i++)
+          if (c.filters[i] == filter) c.filters.erase(c.filters.begin() + i--);
+        if (!c.session.empty()) sessions[c.session] = c.filters;
+        codes += '\0';
+      }
+      send_packet(c, 0xB0, u16_str(pid) + (c.v5 ? std::string(1, '\0') + codes : ""));
+      return true;
+    }
+    case 12: send_packet(c, 0xD0, ""); return true;  // PINGREQ
+    case 14: return false;                          // DISCONNECT
+    default: return true;
+  }
+}
+
+static bool pump(Conn& c) {
+  char buf[4096];
+  ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+  if (n <= 0) return false;
+  c.in.append(buf, n);
+  for (;;) {
+    if (c.in.size() < 2) return true;
+    size_t len = 0, i = 1, mult = 1;
+    for (;; i++) {
+      if (i >= c.in.size()) return true;
+      if (i > 4) return false;
+      uint8_t d = c.in[i];
+      len += (d & 127) * mult, mult <<= 7;
+      if (!(d & 128)) break;
+    }
+    if (c.in.size() < i + 1 + len) return true;
+    uint8_t header = c.in[0];
+    std::string body = c.in.substr(i + 1, len);
+    c.in.erase(0, i + 1 + len);
+    if (!handle_packet(c, header, body)) return false;
+  }
+}
+
+int main(int argc, char** argv) {
+  int port = 1883, opt;
+  long drop_every = 0;
+  while ((opt = getopt(argc, argv, "p:d:v")) != -1) {
+    if (opt == 'p') port = atoi(optarg);
+    else if (opt == 'd') drop_every = atol(optarg);
+    else if (opt == 'v') verbose = true;
+    else {
+      fprintf(stderr, "usage: %s [-p port] [-d drop_every_ms] [-v]\n", argv[0]);
+      return 1;
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  int lfd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0) {
+    perror("broker_standin");
+    return 1;
+  }
+  printf("broker stand-in listening on 127.0.0.1:%d\n", port);
+  long last_tick = now_ms(), last_drop = now_ms();
+  for (;;) {
+    std::vector<struct pollfd> pfds(1, {lfd, POLLIN, 0});
+    for (auto& c : conns) pfds.push_back({c.fd, POLLIN, 0});
+    poll(pfds.data(), pfds.size(), 100);
+    if (pfds[0].revents & POLLIN) {
+      int fd = accept(lfd, NULL, NULL);
+      if (fd >= 0) {
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conns.push_back({fd, "", {}, false, false, "", {}});
+      }
+    }
+    for (size_t i = 1; i < pfds.size(); i++)
+      if ((pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) && conns[i - 1].fd >= 0 && !pump(conns[i - 1])) {
+        close(conns[i - 1].fd);
+        conns[i - 1].fd = -1;
+      }
+    long t = now_ms();
+    if (t - last_tick >= 1000) {
+      last_tick = t;
+      deliver("unix_time/unix_time", std::to_string((long)time(NULL)), false);
+    }
+    if (drop_every && t - last_drop >= drop_every) {
+      last_drop = t;
+      for (auto& c : conns) if (c.fd >= 0) close(c.fd), c.fd = -1;
+      if (verbose) printf("dropped all clients\n");
+    }
+    for (size_t i = 0; i < conns.size(); i++)
+      if (conns[i].fd < 0) conns.erase(conns.begin() + i--);
+  }
+}
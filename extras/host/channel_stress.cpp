@@ -0,0 +1,146 @@
+// Stress test for channel_MqttT.hpp: a producer thread and a consumer
+// thread hammer an MqttRing and an MqttLatest, and the consumer checks what
+// comes out.  See the Makefile next to this file:
+//
+//   make stress                     # plain
+//   make stress SANITIZE=thread     # under ThreadSanitizer
+//
+// STRESS_COUNT (default 1000000) is how many messages each test sends.
+// Exits 0 when everything checked out, 1 (with the first few problems on
+// stderr) when it didn't.
+#include <Arduino.h>
+#include <thread>
+#include "channel_MqttT.hpp"
+
+// Every word is worked out from seq, so a read that mixes two writes shows.
+struct Sample {
+  uint32_t seq;
+  uint32_t words[7];
+
+  void fill(uint32_t s) {
+    seq = s;
+    for (int i = 0; i < 7; i++) words[i] = s * 2654435761u + i;
+  }
+  bool whole() const {
+    for (int i = 0; i < 7; i++)
+      if (words[i] != seq * 2654435761u + i) return false;
+    return true;
+  }
+};
+
+static unsigned long problems;
+
+static void problem(const char* test, const char* what, uint32_t got, uint32_t expected) {
+  if (problems++ < 10) fprintf(stderr, "%s: %s (got %u, expected %u)\n", test, what, (unsigned)got, (unsigned)expected);
+}
+
+// The producer retries when the ring is full, so every message has to come
+// out, in order and whole.
+static void ring_lossless(uint32_t count) {
+  static MqttRing<Sample, 64> ring;
+  std::thread producer([count]() {
+    Sample s;
+    for (uint32_t i = 0; i < count; i++) {
+      s.fill(i);
+      while (!ring.push(s)) std::this_thread::yield();
+    }
+  });
+  uint32_t expected = 0;
+  Sample s;
+  while (expected < count) {
+    if (!ring.pop(s)) {
+      std::this_thread::yield();  // on one core the producer needs the CPU
+      continue;
+    }
+    if (!s.whole()) problem("ring", "torn sample", s.seq, expected);
+    if (s.seq != expected) problem("ring", "out of order or lost", s.seq, expected);
+    expected = s.seq + 1;
+  }
+  producer.join();
+  if (ring.pop(s)) problem("ring", "extra sample after the last", s.seq, count);
+  printf("ring: %u samples, %u full-ring retries counted as drops\n", (unsigned)count, (unsigned)ring.dropped());
+}
+
+// The producer doesn't wait, so some are dropped; the rest have to come out
+// in order and whole, and the drops have to account for the difference.
+static void ring_dropping(uint32_t count) {
+  static MqttRing<Sample, 16> ring;
+  static std::atomic<bool> done{false};
+  std::thread producer([count]() {
+    Sample s;
+    for (uint32_t i = 0; i < count; i++) {
+      s.fill(i);
+      ring.push(s);
+      if (!(i & 31)) std::this_thread::yield();  // interleave even on one core
+    }
+    done.store(true, std::memory_order_release);
+  });
+  uint32_t received = 0, last = 0;
+  Sample s;
+  for (;;) {
+    bool finished = done.load(std::memory_order_acquire);
+    if (ring.pop(s)) {
+      if (!s.whole()) problem("ring (dropping)", "torn sample", s.seq, s.seq);
+      if (received && s.seq <= last) problem("ring (dropping)", "out of order", s.seq, last + 1);
+      last = s.seq;
+      received++;
+    } else if (finished) {
+      break;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  if (received + ring.dropped() != count)
+    problem("ring (dropping)", "received plus dropped isn't what was sent", received + ring.dropped(), count);
+  printf("ring (dropping): %u received, %u dropped\n", (unsigned)received, (unsigned)ring.dropped());
+}
+
+// Values only go forwards, are never torn, a fresh one is always newer than
+// the one before, and the last one set is the last one read.
+static void latest(uint32_t count) {
+  static MqttLatest<Sample> slot;
+  static std::atomic<bool> done{false};
+  std::thread producer([count]() {
+    Sample s;
+    for (uint32_t i = 1; i <= count; i++) {
+      s.fill(i);
+      slot.set(s);
+      if (!(i & 31)) std::this_thread::yield();
+    }
+    done.store(true, std::memory_order_release);
+  });
+  uint32_t last = 0, fresh = 0;
+  Sample s;
+  for (;;) {
+    bool finished = done.load(std::memory_order_acquire);
+    bool changed = slot.getIfChanged(s);
+    if (changed) {
+      fresh++;
+      if (!s.whole()) problem("latest", "torn value", s.seq, s.seq);
+      if (s.seq <= last) problem("latest", "fresh value isn't newer", s.seq, last + 1);
+      last = s.seq;
+    } else {
+      if (s.seq != last) problem("latest", "value changed without being fresh", s.seq, last);
+      std::this_thread::yield();
+    }
+    if (finished && !changed) break;
+  }
+  producer.join();
+  if (last != count) problem("latest", "last value read isn't the last set", last, count);
+  printf("latest: %u set, %u seen fresh\n", (unsigned)count, (unsigned)fresh);
+}
+
+int main() {
+  const char* env = getenv("STRESS_COUNT");
+  uint32_t count = env ? strtoul(env, NULL, 10) : 1000000;
+  ring_lossless(count);
+  ring_dropping(count);
+  latest(count);
+  if (problems) {
+    fprintf(stderr, "%lu problems\n", problems);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,69 @@
+// Entry point for the host build: runs the sketch's setup()/loop() the way
+// the ESP32 Arduino core's main task does, and provides the singletons
+// the shim headers declare.  See the Makefile next to this file.
+#include <Arduino.h>
+#include <WiFi.h>
+#include <ETH.h>
+#include <SPI.h>
+#include <ArduinoOTA.h>
+#include <esp_task_wdt.h>
+#include <signal.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+ETHClass ETH;
+SPIClass SPI;
+ArduinoOTAClass ArduinoOTA;
+
+void setup();
+void loop();
+
+static volatile uint32_t wdt_timeout_ms;
+static volatile unsigned long wdt_last_feed;
+static volatile bool wdt_armed;
+
+static void* wdt_thread(void*) {
+  for (;;) {
+    usleep(100000);
+    if (wdt_armed && wdt_timeout_ms && millis() - wdt_last_feed > wdt_timeout_ms) {
+      fprintf(stderr, "task watchdog expired after %u ms\n", (unsigned)wdt_timeout_ms);
+      _exit(2);
+    }
+  }
+  return NULL;
+}
+
+esp_err_t esp_task_wdt_init(const esp_task_wdt_config_t* config) {
+  static bool started;
+  wdt_timeout_ms = config->timeout_ms;
+  wdt_last_feed = millis();
+  if (!started) {
+    pthread_t t;
+    pthread_create(&t, NULL, wdt_thread, NULL);
+    pthread_detach(t);
+    started = true;
+  }
+  return ESP_OK;
+}
+esp_err_t esp_task_wdt_deinit() { wdt_armed = false; return ESP_OK; }
+esp_err_t esp_task_wdt_add(TaskHandle_t) { wdt_last_feed = millis(); wdt_armed = true; return ESP_OK; }
+// One watchdog for the whole process here, so a task leaving it changes nothing.
+esp_err_t esp_task_wdt_delete(TaskHandle_t) { return ESP_OK; }
+esp_err_t esp_task_wdt_reset() { wdt_last_feed = millis(); return ESP_OK; }
+
+// MQTTT_HOST_RUN_MS=n makes the sketch exit normally after n ms, so that
+// profilers which write their results at exit (gprof, gcov) get them.
+int main() {
+  signal(SIGPIPE, SIG_IGN);
+  const char* env = getenv("MQTTT_HOST_RUN_MS");
+  unsigned long run_ms = env ? strtoul(env, NULL, 10) : 0;
+  setup();
+  for (;;) {
+    loop();
+    if (run_ms && millis() >= run_ms) {
+      fflush(stdout);
+      exit(0);
+    }
+  }
+}
@@ -0,0 +1,81 @@
+// Host (Linux) stand-in for the parts of the ESP32 Arduino core that the
+// MqttTemplates headers use.  Only enough to compile and run the template
+// core on a PC -- this is not a general Arduino emulator.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define ESP_ARDUINO_VERSION_MAJOR 3
+#define MQTTT_HOST_BUILD 1
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// No separate program memory on a PC (PubSubClient's publish_P uses these).
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_byte_near(p) pgm_read_byte(p)
+#define strlen_P strlen
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+static inline unsigned long micros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  static const uint64_t start = (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+  return (unsigned long)(((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000) - start);
+}
+static inline unsigned long millis() { return micros() / 1000; }
+static inline void delay(unsigned long ms) { usleep(ms * 1000); }
+static inline void delayMicroseconds(unsigned int us) { usleep(us); }
+static inline void yield() { usleep(0); }
+
+static inline void pinMode(uint8_t, uint8_t) {}
+static inline void digitalWrite(uint8_t, uint8_t) {}
+static inline int digitalRead(uint8_t) { return HIGH; }
+static inline uint16_t analogRead(uint8_t) { return 0; }
+
+// newlib has strlcpy(); older glibc does not.
+static inline size_t host_strlcpy(char* dst, const char* src, size_t size) {
+  size_t n = strlen(src);
+  if (size) {
+    size_t c = n < size - 1 ? n : size - 1;
+    memcpy(dst, src, c);
+    dst[c] = 0;
+  }
+  return n;
+}
+#define strlcpy host_strlcpy
+
+static inline long random(long howbig) { return howbig ? (::random() % howbig) : 0; }
+static inline long random(long howsmall, long howbig) { return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall); }
+static inline uint32_t esp_random() { return (uint32_t)::random() ^ ((uint32_t)::random() << 16); }
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+#include "HardwareSerial.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "Esp.h"
+
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
+#define ARDUINO_RUNNING_CORE 1
@@ -0,0 +1,27 @@
+// Host stand-in for ArduinoOTA: accepts configuration, never updates.
+#pragma once
+#include "Arduino.h"
+#include <functional>
+
+typedef enum { OTA_AUTH_ERROR, OTA_BEGIN_ERROR, OTA_CONNECT_ERROR, OTA_RECEIVE_ERROR, OTA_END_ERROR } ota_error_t;
+#define U_FLASH 0
+#define U_SPIFFS 100
+
+class ArduinoOTAClass {
+public:
+  typedef std::function<void(void)> THandlerFunction;
+  typedef std::function<void(ota_error_t)> THandlerFunction_Error;
+  typedef std::function<void(unsigned int, unsigned int)> THandlerFunction_Progress;
+  ArduinoOTAClass& setHostname(const char*) { return *this; }
+  ArduinoOTAClass& setPassword(const char*) { return *this; }
+  ArduinoOTAClass& setPort(uint16_t) { return *this; }
+  ArduinoOTAClass& onStart(THandlerFunction) { return *this; }
+  ArduinoOTAClass& onEnd(THandlerFunction) { return *this; }
+  ArduinoOTAClass& onError(THandlerFunction_Error) { return *this; }
+  ArduinoOTAClass& onProgress(THandlerFunction_Progress) { return *this; }
+  void begin() {}
+  void handle() {}
+  int getCommand() { return U_FLASH; }
+};
+
+extern ArduinoOTAClass ArduinoOTA;
@@ -0,0 +1,32 @@
+// Host stand-in for the ESP32 ETH library: the link is always up.
+#pragma once
+#include "WiFi.h"
+#include "SPI.h"
+
+#ifndef ETH_PHY_SPI_FREQ_MHZ
+#define ETH_PHY_SPI_FREQ_MHZ 20
+#endif
+
+typedef enum { ETH_PHY_LAN8720, ETH_PHY_TLK110, ETH_PHY_RTL8201, ETH_PHY_DP83848, ETH_PHY_KSZ8041,
+               ETH_PHY_KSZ8081, ETH_PHY_IP101, ETH_PHY_W5500 } eth_phy_type_t;
+typedef enum { ETH_CLOCK_GPIO0_IN, ETH_CLOCK_GPIO0_OUT, ETH_CLOCK_GPIO16_OUT, ETH_CLOCK_GPIO17_OUT } eth_clock_mode_t;
+
+class ETHClass {
+public:
+  template <typename... Args> bool begin(Args...) {
+    WiFi.host_fire_event(ARDUINO_EVENT_ETH_START);
+    WiFi.host_fire_event(ARDUINO_EVENT_ETH_CONNECTED);
+    WiFi.host_fire_event(ARDUINO_EVENT_ETH_GOT_IP);
+    return true;
+  }
+  bool linkUp() { return true; }
+  bool fullDuplex() { return true; }
+  uint8_t linkSpeed() { return 100; }
+  bool setHostname(const char*) { return true; }
+  bool config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress()) { return true; }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+  uint8_t* macAddress(uint8_t* mac) { host_mac_address(mac); return mac; }
+  String macAddress() { uint8_t mac[6]; host_mac_address(mac); return host_mac_string(mac); }
+};
+
+extern ETHClass ETH;
@@ -0,0 +1,12 @@
+// Host stand-in for the ESP object.
+#pragma once
+
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return 200000; }
+  uint32_t getMinFreeHeap() { return 180000; }
+  uint32_t getHeapSize() { return 320000; }
+  void restart() { fflush(stdout); exit(3); }
+};
+
+extern EspClass ESP;
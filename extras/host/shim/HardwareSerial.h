@@ -0,0 +1,25 @@
+// Host stand-in for the ESP32 Serial port: output goes to stdout, and the
+// sketch exits once nothing is reading it any more.
+#pragma once
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) { setvbuf(stdout, NULL, _IOLBF, 0); }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* b, size_t n) override {
+    size_t done = fwrite(b, 1, n, stdout);
+    if (ferror(stdout)) _exit(0);  // whoever was reading went away (e.g. bench.sh got its line)
+    return done;
+  }
+  using Print::write;
+  using Print::print;
+  size_t print(const IPAddress& ip) { return print(ip.toString()); }
+  template <typename T> size_t println(const T& v) { size_t n = print(v); return n + print("\n"); }
+  size_t println() { return print("\n"); }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,30 @@
+// Host stand-in for Arduino's IPAddress (IPv4 only).
+#pragma once
+
+class IPAddress {
+  uint8_t a[4];
+public:
+  IPAddress() : a{0, 0, 0, 0} {}
+  IPAddress(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) : a{b0, b1, b2, b3} {}
+  IPAddress(uint32_t v) { memcpy(a, &v, 4); }
+  operator uint32_t() const { uint32_t v; memcpy(&v, a, 4); return v; }
+  uint8_t operator[](int i) const { return a[i]; }
+  uint8_t& operator[](int i) { return a[i]; }
+  bool fromString(const char* s) {
+    unsigned v[4];
+    char tail;
+    if (sscanf(s, "%u.%u.%u.%u%c", &v[0], &v[1], &v[2], &v[3], &tail) != 4) return false;
+    for (int i = 0; i < 4; i++) {
+      if (v[i] > 255) return false;
+      a[i] = v[i];
+    }
+    return true;
+  }
+  String toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", a[0], a[1], a[2], a[3]);
+    return String(buf);
+  }
+};
+
+static inline size_t print_ipaddress(Print& p, const IPAddress& ip) { return p.print(ip.toString()); }
@@ -0,0 +1,31 @@
+// Host stand-in for the ESP32 Preferences (NVS) library: each key is a file
+// under $MQTTT_HOST_NVS (default /tmp/mqttt_nvs), named namespace.key.
+#pragma once
+#include "Arduino.h"
+#include <sys/stat.h>
+
+class Preferences {
+  char ns[16] = {0};
+  bool ro = true;
+  void path(const char* key, char* out, size_t n) {
+    const char* dir = getenv("MQTTT_HOST_NVS");
+    if (!dir) dir = "/tmp/mqttt_nvs";
+    mkdir(dir, 0755);
+    snprintf(out, n, "%s/%s.%s", dir, ns, key);
+  }
+public:
+  bool begin(const char* name, bool readOnly = false) { strncpy(ns, name, 15); ro = readOnly; return true; }
+  void end() {}
+  size_t getBytes(const char* key, void* buf, size_t len) {
+    char p[256]; path(key, p, sizeof(p));
+    FILE* f = fopen(p, "rb"); if (!f) return 0;
+    size_t n = fread(buf, 1, len, f); fclose(f); return n;
+  }
+  size_t putBytes(const char* key, const void* buf, size_t len) {
+    if (ro) return 0;
+    char p[256]; path(key, p, sizeof(p));
+    fprintf(stderr, "[host] nvs write %s (%u bytes)\n", key, (unsigned)len);
+    FILE* f = fopen(p, "wb"); if (!f) return 0;
+    size_t n = fwrite(buf, 1, len, f); fclose(f); return n;
+  }
+};
@@ -0,0 +1,25 @@
+// Host stand-in for Arduino's Stream base class.
+#pragma once
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+  void setTimeout(unsigned long ms) { timeout_ms = ms; }
+  // Like Arduino's: waits up to the timeout for each byte.
+  size_t readBytes(uint8_t* buffer, size_t length) {
+    size_t n = 0;
+    unsigned long start = millis();
+    while (n < length && millis() - start < timeout_ms) {
+      int c = read();
+      if (c < 0) { delay(1); continue; }
+      buffer[n++] = (uint8_t)c;
+    }
+    return n;
+  }
+  size_t readBytes(char* buffer, size_t length) { return readBytes((uint8_t*)buffer, length); }
+protected:
+  unsigned long timeout_ms = 1000;
+};
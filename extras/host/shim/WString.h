@@ -0,0 +1,23 @@
+// Host stand-in for the Arduino String class (only what the templates use).
+#pragma once
+#include <string>
+
+class String {
+  std::string s;
+public:
+  String() {}
+  String(const char* c) : s(c ? c : "") {}
+  String(const std::string& c) : s(c) {}
+  String(int v) : s(std::to_string(v)) {}
+  String(unsigned v) : s(std::to_string(v)) {}
+  String(long v) : s(std::to_string(v)) {}
+  String(unsigned long v) : s(std::to_string(v)) {}
+  const char* c_str() const { return s.c_str(); }
+  unsigned length() const { return s.size(); }
+  String& operator+=(const String& o) { s += o.s; return *this; }
+  String operator+(const String& o) const { return String(s + o.s); }
+  friend String operator+(const char* a, const String& b) { return String(std::string(a) + b.s); }
+  bool operator==(const String& o) const { return s == o.s; }
+  bool operator==(const char* o) const { return s == (o ? o : ""); }
+  bool operator!=(const char* o) const { return !(*this == o); }
+};
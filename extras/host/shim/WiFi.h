@@ -0,0 +1,147 @@
+// Host stand-in for the ESP32 WiFi library.  The "radio" is always in
+// range: begin() connects immediately and scans report one access point
+// for whatever SSID was last passed to begin().  MQTTT_HOST_MAC overrides
+// the reported station MAC (12 hex digits).
+#pragma once
+#include "Arduino.h"
+#include "WiFiClient.h"
+#include "WiFiClientSecure.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0, WL_NO_SSID_AVAIL, WL_SCAN_COMPLETED, WL_CONNECTED,
+  WL_CONNECT_FAILED, WL_CONNECTION_LOST, WL_DISCONNECTED
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA, WIFI_AP, WIFI_AP_STA } wifi_mode_t;
+typedef enum { WIFI_FAST_SCAN = 0, WIFI_ALL_CHANNEL_SCAN } wifi_scan_method_t;
+typedef enum { WIFI_AUTH_OPEN = 0, WIFI_AUTH_WEP, WIFI_AUTH_WPA_PSK, WIFI_AUTH_WPA2_PSK,
+               WIFI_AUTH_WPA_WPA2_PSK, WIFI_AUTH_WPA2_ENTERPRISE } wifi_auth_mode_t;
+typedef enum { WPA2_AUTH_TLS = 0, WPA2_AUTH_PEAP, WPA2_AUTH_TTLS } wpa2_auth_method_t;
+
+typedef enum {
+  ARDUINO_EVENT_WIFI_STA_START = 0, ARDUINO_EVENT_WIFI_STA_CONNECTED, ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP, ARDUINO_EVENT_ETH_START, ARDUINO_EVENT_ETH_STOP,
+  ARDUINO_EVENT_ETH_CONNECTED, ARDUINO_EVENT_ETH_DISCONNECTED, ARDUINO_EVENT_ETH_GOT_IP
+} arduino_event_id_t;
+typedef arduino_event_id_t WiFiEvent_t;
+typedef void (*WiFiEventCb)(WiFiEvent_t);
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+static inline void host_mac_address(uint8_t* mac) {
+  static const uint8_t fallback[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+  memcpy(mac, fallback, 6);
+  const char* env = getenv("MQTTT_HOST_MAC");
+  if (env && strlen(env) >= 12)
+    for (int i = 0; i < 6; i++) {
+      char hex[3] = {env[2 * i], env[2 * i + 1], 0};
+      mac[i] = (uint8_t)strtoul(hex, NULL, 16);
+    }
+}
+
+static inline String host_mac_string(const uint8_t* mac) {
+  char buf[18];
+  snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return String(buf);
+}
+
+class WiFiClass {
+  wl_status_t _status = WL_DISCONNECTED;
+  String _ssid;
+  uint8_t _bssid[6] = {0x02, 0x11, 0x22, 0x33, 0x44, 0x55};
+  int32_t _channel = 6;
+  bool _scan_running = false;
+  int16_t _scan_count = 0;
+  String _scan_ssid;
+  WiFiEventCb _handlers[8] = {};
+
+public:
+  // Events are delivered synchronously on the host, from whichever call
+  // caused them (the device delivers them from its event task).
+  void host_fire_event(WiFiEvent_t event) {
+    for (WiFiEventCb h : _handlers) if (h) h(event);
+  }
+  bool mode(wifi_mode_t) { return true; }
+  bool disconnect(bool = false, bool = false) { _status = WL_DISCONNECTED; return true; }
+  void onEvent(WiFiEventCb cb) {
+    for (WiFiEventCb& h : _handlers) if (!h) { h = cb; return; }
+  }
+  void setScanMethod(wifi_scan_method_t) {}
+  bool config(IPAddress ip, IPAddress, IPAddress, IPAddress = IPAddress(), IPAddress = IPAddress()) {
+    fprintf(stderr, "[host] config %s\n", (uint32_t)ip ? ip.toString().c_str() : "dhcp");
+    return true;
+  }
+  bool setHostname(const char*) { return true; }
+  bool setAutoReconnect(bool) { return true; }
+
+  wl_status_t begin(const char* ssid, const char* = NULL, int32_t channel = 0, const uint8_t* = NULL, bool = true) {
+    _ssid = ssid;
+    if (channel) _channel = channel;
+    fprintf(stderr, "[host] begin channel %d\n", (int)channel);
+    _status = WL_CONNECTED;
+    host_fire_event(ARDUINO_EVENT_WIFI_STA_CONNECTED);
+    host_fire_event(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    return _status;
+  }
+  wl_status_t begin(const char* ssid, wpa2_auth_method_t, const char*, const char*, const char* password,
+                    const char*, const char*, const char*, int = -1, int32_t channel = 0, const uint8_t* bssid = NULL, bool = true) {
+    return begin(ssid, password, channel, bssid);
+  }
+  wl_status_t status() { return _status; }
+
+  // The access point sits on MQTTT_HOST_CHANNEL (default 6); a scan limited
+  // to another channel finds nothing.  Scans log what they were asked for.
+  int16_t scanNetworks(bool async = false, bool = false, bool = false, uint32_t = 300, uint8_t channel = 0, const char* ssid = NULL, const uint8_t* = NULL) {
+    const char* env = getenv("MQTTT_HOST_CHANNEL");
+    if (env) _channel = atoi(env);
+    if (ssid) _scan_ssid = ssid;
+    _scan_count = (channel == 0 || channel == _channel) ? 1 : 0;
+    fprintf(stderr, "[host] scan channel %d -> %d\n", channel, _scan_count);
+    _scan_running = async;
+    return async ? WIFI_SCAN_RUNNING : _scan_count;
+  }
+  int16_t scanComplete() {
+    if (!_scan_running) return _scan_count;
+    _scan_running = false;
+    return WIFI_SCAN_RUNNING;
+  }
+  void scanDelete() { _scan_running = false; }
+  String SSID(uint8_t) { return _scan_ssid.length() ? _scan_ssid : _ssid; }
+  String SSID() { return _ssid; }
+  wifi_auth_mode_t encryptionType(uint8_t) { return WIFI_AUTH_WPA2_PSK; }
+  int32_t RSSI(uint8_t) { return -55; }
+  int8_t RSSI() { return -55; }
+  uint8_t* BSSID(uint8_t) { return _bssid; }
+  uint8_t* BSSID() { return _bssid; }
+  int32_t channel(uint8_t) { return _channel; }
+  int32_t channel() { return _channel; }
+
+  uint8_t* macAddress(uint8_t* mac) { host_mac_address(mac); return mac; }
+  String macAddress() { uint8_t mac[6]; host_mac_address(mac); return host_mac_string(mac); }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress gatewayIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress subnetMask() { return IPAddress(255, 0, 0, 0); }
+  IPAddress dnsIP(uint8_t = 0) { return IPAddress(127, 0, 0, 1); }
+  int hostByName(const char* host, IPAddress& result) {
+    // Under MQTTT_HOST_BROKER every name resolves to the stand-in broker.
+    char redirected[128];
+    const char* env = getenv("MQTTT_HOST_BROKER");
+    if (env && *env) {
+      strncpy(redirected, env, sizeof(redirected) - 1);
+      redirected[sizeof(redirected) - 1] = 0;
+      char* colon = strrchr(redirected, ':');
+      if (colon) *colon = 0;
+      host = redirected;
+    }
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || !res) return 0;
+    result = IPAddress((uint32_t)((struct sockaddr_in*)res->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(res);
+    return 1;
+  }
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,116 @@
+// Host stand-in for WiFiClient: a blocking POSIX TCP socket.
+//
+// If MQTTT_HOST_BROKER is set in the environment (host:port), every
+// connect() goes there instead, so the example sketches can run unmodified
+// against a local broker stand-in.
+#pragma once
+#include "Arduino.h"
+#include "Client.h"
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+
+class WiFiClient : public Client {
+protected:
+  int fd = -1;
+  uint32_t connect_timeout_ms = 3000;
+
+  int connect_to(const char* host, uint16_t port, uint32_t timeout_ms) {
+    stop();
+    char redirected[128];
+    const char* env = getenv("MQTTT_HOST_BROKER");
+    if (env && *env) {
+      strncpy(redirected, env, sizeof(redirected) - 1);
+      redirected[sizeof(redirected) - 1] = 0;
+      char* colon = strrchr(redirected, ':');
+      if (colon) *colon = 0, port = (uint16_t)atoi(colon + 1);
+      host = redirected;
+    }
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    char portstr[8];
+    snprintf(portstr, sizeof(portstr), "%u", port);
+    if (getaddrinfo(host, portstr, &hints, &res) != 0 || !res) return 0;
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0) { freeaddrinfo(res); return 0; }
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int rc = ::connect(fd, res->ai_addr, res->ai_addrlen);
+    int connect_errno = errno;
+    freeaddrinfo(res);
+    if (rc != 0 && connect_errno == EINPROGRESS) {
+      struct pollfd p = {fd, POLLOUT, 0};
+      int err = 0;
+      socklen_t len = sizeof(err);
+      if (poll(&p, 1, (int)timeout_ms) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) rc = 0;
+    }
+    if (rc != 0) { stop(); return 0; }
+    fcntl(fd, F_SETFL, flags);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return 1;
+  }
+
+public:
+  virtual ~WiFiClient() { stop(); }
+  int connect(IPAddress ip, uint16_t port) override { return connect_to(ip.toString().c_str(), port, connect_timeout_ms); }
+  int connect(const char* host, uint16_t port) override { return connect_to(host, port, connect_timeout_ms); }
+  int connect(IPAddress ip, uint16_t port, int32_t timeout_ms) { return connect_to(ip.toString().c_str(), port, timeout_ms); }
+  int connect(const char* host, uint16_t port, int32_t timeout_ms) { return connect_to(host, port, timeout_ms); }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buf, size_t size) override {
+    if (fd < 0) return 0;
+    size_t sent = 0;
+    while (sent < size) {
+      ssize_t n = ::send(fd, buf + sent, size - sent, MSG_NOSIGNAL);
+      if (n <= 0) { stop(); break; }
+      sent += n;
+    }
+    return sent;
+  }
+  int available() override {
+    if (fd < 0) return 0;
+    int n = 0;
+    if (ioctl(fd, FIONREAD, &n) < 0) return 0;
+    if (n == 0) {
+      uint8_t b;
+      ssize_t r = ::recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) stop();
+    }
+    return n;
+  }
+  int read() override {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+  int read(uint8_t* buf, size_t size) override {
+    if (fd < 0) return -1;
+    ssize_t n = ::recv(fd, buf, size, MSG_DONTWAIT);
+    if (n == 0) { stop(); return -1; }
+    if (n < 0) return -1;
+    return (int)n;
+  }
+  int peek() override {
+    if (fd < 0) return -1;
+    uint8_t b;
+    return ::recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) == 1 ? b : -1;
+  }
+  void flush() override {}
+  void stop() override {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+  }
+  uint8_t connected() override {
+    if (fd < 0) return 0;
+    available();
+    return fd >= 0;
+  }
+  operator bool() override { return fd >= 0; }
+  void setTimeout(uint32_t seconds) { connect_timeout_ms = seconds * 1000; }
+};
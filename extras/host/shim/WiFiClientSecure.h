@@ -0,0 +1,12 @@
+// Host stand-in for WiFiClientSecure.  There is no TLS on the host build:
+// certificate settings are accepted and ignored, and the connection is
+// plain TCP to whatever MQTTT_HOST_BROKER points at.
+#pragma once
+#include "WiFiClient.h"
+
+class WiFiClientSecure : public WiFiClient {
+public:
+  void setCACert(const char*) {}
+  void setInsecure() {}
+  void setHandshakeTimeout(unsigned long) {}
+};
@@ -0,0 +1,2 @@
+// Host stand-in: WPA2-Enterprise has nothing to configure on the host.
+#pragma once
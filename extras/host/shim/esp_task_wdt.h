@@ -0,0 +1,20 @@
+// Host stand-in for the ESP32 task watchdog.  The watchdog is real: if
+// the subscribed task is not fed within the timeout, the process exits
+// with status 2, the way the device would reset.
+#pragma once
+#include "Arduino.h"
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+typedef struct {
+  uint32_t timeout_ms;
+  uint32_t idle_core_mask;
+  bool trigger_panic;
+} esp_task_wdt_config_t;
+
+esp_err_t esp_task_wdt_init(const esp_task_wdt_config_t* config);
+esp_err_t esp_task_wdt_deinit();
+esp_err_t esp_task_wdt_add(TaskHandle_t task);
+esp_err_t esp_task_wdt_delete(TaskHandle_t task);
+esp_err_t esp_task_wdt_reset();
@@ -0,0 +1,39 @@
+// Host stand-in for the subset of FreeRTOS used by the templates, built on
+// pthreads.  One tick is one millisecond.
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define configMAX_PRIORITIES 25
+#define portNUM_PROCESSORS 2
+
+struct portMUX_TYPE { pthread_mutex_t m; };
+#define portMUX_INITIALIZER_UNLOCKED { PTHREAD_MUTEX_INITIALIZER }
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->m)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->m)
+#define taskENTER_CRITICAL(mux) portENTER_CRITICAL(mux)
+#define taskEXIT_CRITICAL(mux) portEXIT_CRITICAL(mux)
+
+static inline void freertos_shim_deadline(struct timespec* ts, TickType_t ticks) {
+  clock_gettime(CLOCK_REALTIME, ts);
+  ts->tv_sec += ticks / 1000;
+  ts->tv_nsec += (long)(ticks % 1000) * 1000000L;
+  if (ts->tv_nsec >= 1000000000L) ts->tv_sec++, ts->tv_nsec -= 1000000000L;
+}
+
+static inline BaseType_t xPortGetCoreID() { return 1; }
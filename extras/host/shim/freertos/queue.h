@@ -0,0 +1,67 @@
+// Host stand-in for FreeRTOS queues (copy-in/copy-out, fixed item size).
+#pragma once
+#include "FreeRTOS.h"
+#include <string.h>
+#include <stdlib.h>
+
+struct freertos_shim_queue {
+  pthread_mutex_t m;
+  pthread_cond_t c;
+  uint8_t* items;
+  UBaseType_t length, item_size, head, count;
+};
+typedef freertos_shim_queue* QueueHandle_t;
+
+static inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  freertos_shim_queue* q = new freertos_shim_queue;
+  pthread_mutex_init(&q->m, NULL);
+  pthread_cond_init(&q->c, NULL);
+  q->items = (uint8_t*)malloc(length * item_size);
+  q->length = length, q->item_size = item_size, q->head = 0, q->count = 0;
+  return q;
+}
+
+static inline BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks) {
+  struct timespec dl;
+  freertos_shim_deadline(&dl, ticks);
+  pthread_mutex_lock(&q->m);
+  while (q->count == q->length) {
+    if (ticks == portMAX_DELAY) pthread_cond_wait(&q->c, &q->m);
+    else if (ticks == 0 || pthread_cond_timedwait(&q->c, &q->m, &dl) == ETIMEDOUT) break;
+  }
+  BaseType_t ok = q->count < q->length;
+  if (ok) {
+    memcpy(q->items + ((q->head + q->count) % q->length) * q->item_size, item, q->item_size);
+    q->count++;
+    pthread_cond_broadcast(&q->c);
+  }
+  pthread_mutex_unlock(&q->m);
+  return ok;
+}
+#define xQueueSendToBack xQueueSend
+
+static inline BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks) {
+  struct timespec dl;
+  freertos_shim_deadline(&dl, ticks);
+  pthread_mutex_lock(&q->m);
+  while (q->count == 0) {
+    if (ticks == portMAX_DELAY) pthread_cond_wait(&q->c, &q->m);
+    else if (ticks == 0 || pthread_cond_timedwait(&q->c, &q->m, &dl) == ETIMEDOUT) break;
+  }
+  BaseType_t ok = q->count > 0;
+  if (ok) {
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    pthread_cond_broadcast(&q->c);
+  }
+  pthread_mutex_unlock(&q->m);
+  return ok;
+}
+
+static inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  pthread_mutex_lock(&q->m);
+  UBaseType_t n = q->count;
+  pthread_mutex_unlock(&q->m);
+  return n;
+}
@@ -0,0 +1,75 @@
+// Host stand-in for FreeRTOS mutexes and semaphores.
+#pragma once
+#include "FreeRTOS.h"
+
+struct freertos_shim_sem {
+  pthread_mutex_t m;
+  pthread_cond_t c;
+  int count, max;
+  pthread_t owner;  // recursive mutexes
+  int depth;
+};
+typedef freertos_shim_sem* SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t freertos_shim_sem_new(int count, int max) {
+  freertos_shim_sem* s = new freertos_shim_sem;
+  pthread_mutex_init(&s->m, NULL);
+  pthread_cond_init(&s->c, NULL);
+  s->count = count, s->max = max;
+  s->depth = 0;
+  return s;
+}
+static inline SemaphoreHandle_t xSemaphoreCreateMutex() { return freertos_shim_sem_new(1, 1); }
+static inline SemaphoreHandle_t xSemaphoreCreateBinary() { return freertos_shim_sem_new(0, 1); }
+static inline SemaphoreHandle_t xSemaphoreCreateCounting(int max, int initial) { return freertos_shim_sem_new(initial, max); }
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+  struct timespec dl;
+  freertos_shim_deadline(&dl, ticks);
+  pthread_mutex_lock(&s->m);
+  while (s->count == 0) {
+    if (ticks == portMAX_DELAY) pthread_cond_wait(&s->c, &s->m);
+    else if (pthread_cond_timedwait(&s->c, &s->m, &dl) == ETIMEDOUT) break;
+  }
+  BaseType_t got = s->count > 0;
+  if (got) s->count--;
+  pthread_mutex_unlock(&s->m);
+  return got;
+}
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+  pthread_mutex_lock(&s->m);
+  BaseType_t ok = s->count < s->max;
+  if (ok) s->count++;
+  pthread_cond_signal(&s->c);
+  pthread_mutex_unlock(&s->m);
+  return ok;
+}
+
+static inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() { return freertos_shim_sem_new(1, 1); }
+static inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t s, TickType_t ticks) {
+  struct timespec dl;
+  freertos_shim_deadline(&dl, ticks);
+  pthread_mutex_lock(&s->m);
+  BaseType_t got = pdTRUE;
+  if (s->depth && pthread_equal(s->owner, pthread_self())) {
+    s->depth++;
+  } else {
+    while (s->count == 0 && got) {
+      if (ticks == portMAX_DELAY) pthread_cond_wait(&s->c, &s->m);
+      else if (pthread_cond_timedwait(&s->c, &s->m, &dl) == ETIMEDOUT) got = s->count > 0;
+    }
+    if (got) s->count--, s->owner = pthread_self(), s->depth = 1;
+  }
+  pthread_mutex_unlock(&s->m);
+  return got;
+}
+static inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t s) {
+  pthread_mutex_lock(&s->m);
+  BaseType_t ok = s->depth && pthread_equal(s->owner, pthread_self());
+  if (ok && --s->depth == 0) {
+    s->count++;
+    pthread_cond_signal(&s->c);
+  }
+  pthread_mutex_unlock(&s->m);
+  return ok;
+}
@@ -0,0 +1,49 @@
+// Host stand-in for FreeRTOS tasks.  Tasks are detached pthreads; core
+// affinity and priority are recorded but not enforced.
+#pragma once
+#include "FreeRTOS.h"
+#include <unistd.h>
+
+typedef void (*TaskFunction_t)(void*);
+
+struct freertos_shim_task {
+  TaskFunction_t fn;
+  void* param;
+  const char* name;
+  uint32_t stack;
+  pthread_t thread;
+};
+typedef freertos_shim_task* TaskHandle_t;
+
+static inline void* freertos_shim_task_entry(void* p) {
+  freertos_shim_task* t = (freertos_shim_task*)p;
+  t->fn(t->param);
+  return NULL;
+}
+
+static inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack,
+                                                 void* param, UBaseType_t, TaskHandle_t* handle, BaseType_t) {
+  freertos_shim_task* t = new freertos_shim_task{fn, param, name, stack, pthread_t()};
+  if (pthread_create(&t->thread, NULL, freertos_shim_task_entry, t) != 0) {
+    delete t;
+    return pdFAIL;
+  }
+  pthread_detach(t->thread);
+  if (handle) *handle = t;
+  return pdPASS;
+}
+
+static inline BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack,
+                                     void* param, UBaseType_t prio, TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(fn, name, stack, param, prio, handle, tskNO_AFFINITY);
+}
+
+static inline void vTaskDelay(TickType_t ticks) { usleep((useconds_t)ticks * 1000); }
+static inline void vTaskDelete(TaskHandle_t) { pthread_exit(NULL); }
+// No stack painting on the host; report the full stack as unused.
+static inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t t) { return t ? t->stack : 8192; }
+static inline TickType_t xTaskGetTickCount() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
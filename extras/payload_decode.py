@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+# Decodes payloads written with MqttPayload (see payload_MqttT.hpp), CBOR or
+# MessagePack, into one line of JSON each:
+#
+#   python3 payload_decode.py payload.bin
+#   python3 payload_decode.py --msgpack payload.bin
+#
+#   {"temperature": 21.5, "humidity": 40.2, "pressure": 1013.25}
+#
+# Byte strings come out as hex.  Floats sent as 4 bytes are printed with the
+# 7 significant digits they hold.  From other code: decode(payload_bytes)
+# or decode(payload_bytes, msgpack=True) returns the value, with byte strings
+# as bytes.  Only what MqttPayload writes is understood (no CBOR tags or
+# indefinite lengths, no MessagePack extension types).
+
+import json
+import struct
+import sys
+
+
+class PayloadError(ValueError):
+    pass
+
+
+class _Reader:
+    def __init__(self, buf):
+        self.buf = buf
+        self.pos = 0
+
+    def take(self, n):
+        if self.pos + n > len(self.buf):
+            raise PayloadError("truncated at byte %d" % self.pos)
+        out = bytes(self.buf[self.pos:self.pos + n])
+        self.pos += n
+        return out
+
+    def uint(self, n):
+        return int.from_bytes(self.take(n), "big")
+
+
+def _float32(raw):
+    return float("%.7g" % struct.unpack(">f", raw)[0])
+
+
+def _cbor(r):
+    initial = r.uint(1)
+    major, info = initial >> 5, initial & 0x1F
+    if major == 7:
+        if info == 20:
+            return False
+        if info == 21:
+            return True
+        if info == 22:
+            return None
+        if info == 26:
+            return _float32(r.take(4))
+        if info == 27:
+            return struct.unpack(">d", r.take(8))[0]
+        raise PayloadError("unsupported simple value %d" % info)
+    if info < 24:
+        arg = info
+    elif info <= 27:
+        arg = r.uint(1 << (info - 24))
+    else:
+        raise PayloadError("unsupported length encoding %d" % info)
+    if major == 0:
+        return arg
+    if major == 1:
+        return -1 - arg
+    if major == 2:
+        return r.take(arg)
+    if major == 3:
+        return r.take(arg).decode("utf-8")
+    if major == 4:
+        return [_cbor(r) for _ in range(arg)]
+    if major == 5:
+        return _pairs(r, arg, _cbor)
+    raise PayloadError("unsupported major type %d" % major)
+
+
+def _msgpack(r):
+    b = r.uint(1)
+    if b < 0x80:
+        return b
+    if b >= 0xE0:
+        return b - 0x100
+    if b < 0x90:
+        return _pairs(r, b & 0x0F, _msgpack)
+    if b < 0xA0:
+        return [_msgpack(r) for _ in range(b & 0x0F)]
+    if b < 0xC0:
+        return r.take(b & 0x1F).decode("utf-8")
+    if b == 0xC0:
+        return None
+    if b in (0xC2, 0xC3):
+        return b == 0xC3
+    if b in (0xC4, 0xC5, 0xC6):
+        return r.take(r.uint(1 << (b - 0xC4)))
+    if b == 0xCA:
+        return _float32(r.take(4))
+    if b == 0xCB:
+        return struct.unpack(">d", r.take(8))[0]
+    if 0xCC <= b <= 0xCF:
+        return r.uint(1 << (b - 0xCC))
+    if 0xD0 <= b <= 0xD3:
+        return int.from_bytes(r.take(1 << (b - 0xD0)), "big", signed=True)
+    if b in (0xD9, 0xDA, 0xDB):
+        return r.take(r.uint(1 << (b - 0xD9))).decode("utf-8")
+    if b in (0xDC, 0xDD):
+        return [_msgpack(r) for _ in range(r.uint(2 if b == 0xDC else 4))]
+    if b in (0xDE, 0xDF):
+        return _pairs(r, r.uint(2 if b == 0xDE else 4), _msgpack)
+    raise PayloadError("unsupported type byte 0x%02X" % b)
+
+
+def _pairs(r, n, item):
+    out = {}
+    for _ in range(n):
+        key = item(r)
+        if isinstance(key, bytes):
+            key = key.hex()
+        out[key] = item(r)
+    return out
+
+
+def decode(buf, msgpack=False):
+    r = _Reader(buf)
+    value = (_msgpack if msgpack else _cbor)(r)
+    if r.pos != len(buf):
+        raise PayloadError("%d bytes left over" % (len(buf) - r.pos))
+    return value
+
+
+def _jsonable(value):
+    if isinstance(value, bytes):
+        return value.hex()
+    if isinstance(value, list):
+        return [_jsonable(v) for v in value]
+    if isinstance(value, dict):
+        return {str(k): _jsonable(v) for k, v in value.items()}
+    return value
+
+
+def main(args):
+    msgpack = "--msgpack" in args
+    paths = [a for a in args if a != "--msgpack"]
+    if not paths:
+        sys.exit("usage: payload_decode.py [--msgpack] payload.bin [...]   ('-' reads stdin)")
+    for path in paths:
+        data = sys.stdin.buffer.read() if path == "-" else open(path, "rb").read()
+        print(json.dumps(_jsonable(decode(data, msgpack))))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,101 @@
+// Target test for MqttTlsClient (tls_MqttT.hpp): a full TLS handshake, then
+// a resumed one, against a real server.
+//
+// On a PC on the same network as the board:
+//
+//   extras/tls_resume/tls_server.sh 192.168.1.20
+//
+// with the PC's address, paste the test_ca it prints over the one below, set
+// the WiFi and server, upload, and watch the serial port for PASS or FAIL.
+// Run it once with each core (2.x has mbedTLS 2.28, 3.x has mbedTLS 3), and
+// once with the server started with "noticket", so resuming by session ID is
+// tested as well as by ticket.
+//
+// Checks, in order:
+//  1. a full handshake through open()/handshake(), the way the connection
+//     state machine drives it, and a line echoed over it;
+//  2. a resumed handshake through connect(), and the echo again;
+//  3. a full handshake again after forget_session().
+
+#include <WiFi.h>
+#include "tls_MqttT.hpp"
+
+const char* ssid = "your-ssid";
+const char* password = "your-password";
+const char* server = "192.168.1.20";  // as given to tls_server.sh
+const uint16_t port = 8883;
+
+// From tls_server.sh; it makes a new CA every time it starts.
+const char* test_ca =
+  "-----BEGIN CERTIFICATE-----\n"
+  "paste the CA tls_server.sh prints here\n"
+  "-----END CERTIFICATE-----\n"
+  ;
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+  Serial.printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+  if (!ok) failures++;
+}
+
+// Sends a line and waits for it back reversed (openssl s_server -rev).
+bool echo(MqttTlsClient& tls) {
+  const char* line = "MqttT\n";
+  if (tls.write((const uint8_t*)line, strlen(line)) != strlen(line)) return false;
+  char got[16];
+  size_t n = 0;
+  uint32_t start = millis();
+  while (n < 6 && millis() - start < 5000) {
+    int c = tls.read();
+    if (c < 0) delay(10);
+    else got[n++] = c;
+  }
+  return n == 6 && memcmp(got, "TttqM\n", 6) == 0;
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(2000);
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) delay(100);
+  Serial.printf("WiFi up, testing against %s:%u\n", server, port);
+
+  IPAddress ip;
+  if (!ip.fromString(server)) WiFi.hostByName(server, ip);
+
+  // A session saved in RTC memory survives a reset; start without it.
+  MqttTlsClient* tls = new MqttTlsClient;
+  tls->forget_session();
+  tls->setCACert(test_ca);
+
+  // 1. Full, the state machine's way.
+  int r = -1;
+  if (tls->open(server, ip, port, 5000))
+    while ((r = tls->handshake()) == 0) delay(1);
+  check(r == 1 && !tls->resumed() && tls->stats().full_handshakes == 1, "full handshake (open/handshake)");
+  check(r == 1 && echo(*tls), "echo over the full handshake");
+  tls->stop();
+
+  // 2. Resumed.
+  bool up = tls->connect(server, port);
+  check(up && tls->resumed() && tls->stats().resumed_handshakes == 1, "resumed handshake (connect)");
+  check(up && echo(*tls), "echo over the resumed handshake");
+  tls->stop();
+
+  // 3. Full again once the session is forgotten.
+  tls->forget_session();
+  up = tls->connect(server, port);
+  check(up && !tls->resumed() && tls->stats().full_handshakes == 2, "full handshake after forget_session()");
+  tls->stop();
+
+  const MqttTlsClient::Stats& s = tls->stats();
+  Serial.printf("full %u (last %u ms), resumed %u (last %u ms), failed %u\n", (unsigned)s.full_handshakes,
+                (unsigned)s.last_full_ms, (unsigned)s.resumed_handshakes, (unsigned)s.last_resumed_ms,
+                (unsigned)s.failed_handshakes);
+  delete tls;
+
+  Serial.println(failures ? "FAIL" : "PASS");
+}
+
+void loop() { delay(1000); }
@@ -0,0 +1,37 @@
+#!/bin/sh
+# TLS server for the tls_resume sketch: makes a throwaway CA and a server
+# certificate for the address the device will connect to, prints the CA as
+# a C string to paste into the sketch, and serves TLS 1.2 on the port (8883
+# by default), echoing each line back reversed.
+#
+#   ./tls_server.sh 192.168.1.20            # resumes by session ticket
+#   ./tls_server.sh 192.168.1.20 8883 noticket  # by session ID only
+#
+# Needs openssl on the path.  Stop it with Ctrl-C.
+set -e
+[ -n "$1" ] || { echo "usage: tls_server.sh host-or-ip [port] [noticket]" >&2; exit 1; }
+host=$1
+port=${2:-8883}
+tickets=
+[ "$3" = noticket ] && tickets=-no_ticket
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+case $host in
+  *[!0-9.]*) echo "subjectAltName=DNS:$host" > ext ;;
+  *) echo "subjectAltName=IP:$host" > ext ;;
+esac
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -days 30 \
+  -subj "/CN=MqttT test CA" -keyout ca.key -out ca.pem 2>/dev/null
+openssl req -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes \
+  -subj "/CN=$host" -keyout server.key -out server.csr 2>/dev/null
+openssl x509 -req -in server.csr -CA ca.pem -CAkey ca.key -CAcreateserial -days 30 \
+  -extfile ext -out server.pem 2>/dev/null
+
+echo "const char* test_ca ="
+sed 's/.*/  "&\\n"/' ca.pem
+echo "  ;"
+echo
+openssl s_server -accept "$port" -cert server.pem -key server.key -tls1_2 -rev $tickets
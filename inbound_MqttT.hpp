@@ -0,0 +1,150 @@
+// Handling incoming messages off the networking thread.
+//
+// PubSubClient calls back from inside mqttClient.loop(), so by default every
+// message is handled (mqtt_subscriptions handlers, or printing) right there,
+// and a slow handler holds up keepalives and everything else loop() does.
+// Set inbound_mode from the sketch to have the callback only copy the
+// message into a pool and hand it on:
+//
+//   void setup1() {
+//     inbound_mode = MQTT_INBOUND_TASK;
+//   }
+//
+//   MQTT_INBOUND_INLINE  handled inside mqttClient.loop() (the default)
+//   MQTT_INBOUND_LOOP1   handled by the loop1() task, between loop1() calls
+//                        (so keep loop1() short; without loop1(), as TASK)
+//   MQTT_INBOUND_TASK    handled by a task of its own ("MQTT Inbound",
+//                        inbound_task_stack bytes, inbound_task_priority)
+//
+// The pool is MQTTT_INBOUND_SLOTS messages of up to MQTTT_INBOUND_MSG_BYTES
+// (topic, its terminating 0 and payload), allocated once when the first
+// message arrives.  When every slot is waiting to be handled, or a message
+// is too big for one, the message is dropped and counted in
+// mqtt_inbound.stats(); the connection never waits for the handlers.
+//
+// Handlers get the same arguments as before; the topic and payload stay
+// valid until the handler returns.
+
+#pragma once
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "subscribe_MqttT.hpp"
+
+#ifndef MQTTT_INBOUND_SLOTS
+#define MQTTT_INBOUND_SLOTS 8
+#endif
+#ifndef MQTTT_INBOUND_MSG_BYTES
+#define MQTTT_INBOUND_MSG_BYTES 256
+#endif
+
+enum MqttInboundMode : uint8_t { MQTT_INBOUND_INLINE, MQTT_INBOUND_LOOP1, MQTT_INBOUND_TASK };
+
+// Tunable from the sketch, e.g. in setup1().
+MqttInboundMode inbound_mode = MQTT_INBOUND_INLINE;
+uint32_t inbound_task_stack = 4096;  // bytes
+UBaseType_t inbound_task_priority = 1;
+
+class MqttInbound {
+public:
+  struct Stats {
+    uint32_t received;   // offered by the callback
+    uint32_t delivered;  // handed to the handler
+    uint32_t dropped;    // every slot was in use
+    uint32_t too_big;    // didn't fit in a slot
+    uint8_t most_waiting;
+  };
+
+  // Called by the core's callback.  With own_task, starts the task that
+  // handles messages, and deliver() from anywhere else does nothing (so
+  // handlers only ever run on that task, in order); otherwise deliver() has
+  // to be called.  False if the pool couldn't be allocated.
+  bool begin(MqttHandler handler, bool own_task) {
+    if (ready || failed) return ready != NULL;
+    failed = true;
+    pool = (Msg*)malloc(sizeof(Msg) * MQTTT_INBOUND_SLOTS);
+    free_slots = xQueueCreate(MQTTT_INBOUND_SLOTS, sizeof(uint8_t));
+    QueueHandle_t q = xQueueCreate(MQTTT_INBOUND_SLOTS, sizeof(uint8_t));
+    if (!pool || !free_slots || !q) {
+      Serial.println("mqtt_inbound: out of memory, handling messages inline");
+      return false;
+    }
+    for (uint8_t i = 0; i < MQTTT_INBOUND_SLOTS; i++) xQueueSend(free_slots, &i, 0);
+    this->handler = handler;
+    this->own_task = own_task;
+    ready = q;
+    failed = false;
+    if (own_task)
+      xTaskCreate([](void* self) {
+          while (true) ((MqttInbound*)self)->take(portMAX_DELAY);
+        }, "MQTT Inbound", inbound_task_stack, this, inbound_task_priority, NULL);
+    return true;
+  }
+
+  bool active() const { return ready != NULL; }
+
+  // Networking thread: copies the message for the handler.  Never waits;
+  // false if it had to be dropped.
+  bool offer(const char* topic, const uint8_t* payload, unsigned int length) {
+    st.received++;
+    size_t topic_len = strlen(topic);
+    if (topic_len + 1 + length > MQTTT_INBOUND_MSG_BYTES) {
+      st.too_big++;
+      return false;
+    }
+    uint8_t slot;
+    if (!xQueueReceive(free_slots, &slot, 0)) {
+      st.dropped++;
+      return false;
+    }
+    Msg& m = pool[slot];
+    memcpy(m.data, topic, topic_len + 1);
+    memcpy(m.data + topic_len + 1, payload, length);
+    m.topic_len = topic_len;
+    m.length = length;
+    xQueueSend(ready, &slot, 0);  // can't be full: there are only as many slots
+    UBaseType_t waiting = uxQueueMessagesWaiting(ready);
+    if (waiting > st.most_waiting) st.most_waiting = waiting;
+    return true;
+  }
+
+  // Handler side: handles everything waiting, waiting up to `wait` ticks for
+  // the first message.  Returns how many were handled.
+  size_t deliver(TickType_t wait = 0) { return own_task ? 0 : take(wait); }
+
+  // Counters are written from both tasks without a lock, so they're
+  // approximate while messages are moving.
+  const Stats& stats() const { return st; }
+
+private:
+  size_t take(TickType_t wait) {
+    if (!ready) return 0;
+    size_t n = 0;
+    uint8_t slot;
+    while (xQueueReceive(ready, &slot, n ? 0 : wait)) {
+      Msg& m = pool[slot];
+      handler(m.data, (uint8_t*)m.data + m.topic_len + 1, m.length);
+      xQueueSend(free_slots, &slot, 0);
+      st.delivered++;
+      n++;
+    }
+    return n;
+  }
+
+  struct Msg {
+    uint16_t topic_len, length;
+    char data[MQTTT_INBOUND_MSG_BYTES];
+  };
+
+  MqttHandler handler = NULL;
+  Msg* pool = NULL;
+  QueueHandle_t free_slots = NULL;
+  QueueHandle_t ready = NULL;
+  bool failed = false;
+  bool own_task = false;
+  Stats st = {};
+};
+
+MqttInbound mqtt_inbound;
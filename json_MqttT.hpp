@@ -0,0 +1,165 @@
+// JSON payloads with the schema declared once, as a type.
+//
+// For consumers that need JSON, the usual pattern
+//
+//   snprintf(buf, sizeof(buf), "{\"temperature\":%.1f,\"humidity\":%.1f,\"pressure\":%.2f}", ...);
+//
+// parses the format string on every call and formats each float through
+// printf's double (software floating point on the ESP32).  MqttJson does
+// the same job with the layout fixed at compile time:
+//
+//   MQTT_JSON_FIELD(temperature, float, 1);  // key, type, decimals
+//   MQTT_JSON_FIELD(humidity, float, 1);
+//   MQTT_JSON_FIELD(pressure, float, 2);
+//   typedef MqttJson<temperature, humidity, pressure> Weather;
+//
+//   void connectedLoop() {
+//     char buf[Weather::max_size];  // always big enough
+//     Weather::write(buf, readTemp(), readHumidity(), readPressure());
+//     mqttClient.publish("sensors/all", buf, true);
+//   }
+//
+// The keys, quotes, colons and commas are string literals copied in with
+// lengths known at compile time; numbers are written with integer
+// arithmetic, floats as a whole part and a fraction rounded to the field's
+// decimals.
+// write() puts out {"temperature":21.5,"humidity":40.2,"pressure":1013.25},
+// nul-terminated, and returns its length.  max_size (terminator included)
+// is worked out from the fields' types, so the buffer can't be too small.
+//
+// Fields can be integers, bools, float or double.  A float or double that
+// is NaN, infinite or 9.2e18 or more either way is written as null, and one
+// that rounds to zero is written without a minus sign.  The field name is the JSON key, so it
+// has to be an identifier; the macro declares a struct of that name.
+
+#pragma once
+
+#include <Arduino.h>
+#include <limits>
+#include <type_traits>
+
+// Declares a field type for MqttJson.
+#define MQTT_JSON_FIELD(name, type, decimals)                            \
+  struct name {                                                          \
+    typedef type value_type;                                             \
+    static const char* key() { return "\"" #name "\":"; }               \
+    enum { key_len = sizeof("\"" #name "\":") - 1, places = decimals }; \
+  }
+
+// Longest text a value of type T takes.
+template <class T, int Places,
+          bool Float = std::is_floating_point<T>::value, bool Bool = std::is_same<T, bool>::value>
+struct MqttJsonWidth {
+  enum { value = std::numeric_limits<T>::digits10 + 1 + std::numeric_limits<T>::is_signed };
+};
+template <class T, int Places> struct MqttJsonWidth<T, Places, true, false> {
+  enum { value = 1 + 19 + (Places > 0) + Places };  // sign, whole part, point, decimals
+};
+template <class T, int Places> struct MqttJsonWidth<T, Places, false, true> {
+  enum { value = 5 };  // false
+};
+
+template <int N> struct MqttJsonPow10 {
+  static constexpr uint64_t value = 10 * MqttJsonPow10<N - 1>::value;
+};
+template <> struct MqttJsonPow10<0> {
+  static constexpr uint64_t value = 1;
+};
+
+// The number writers; each returns the end of what it wrote.
+inline char* mqtt_json_digits(char* p, uint64_t v, int min_digits = 1) {
+  char tmp[20];
+  int n = 0;
+  // 32-bit division is much cheaper than 64-bit on the ESP32.
+  while (v > 0xFFFFFFFFu) tmp[n++] = '0' + v % 10, v /= 10;
+  for (uint32_t w = v; w || n < min_digits; w /= 10) tmp[n++] = '0' + w % 10;
+  while (n) *p++ = tmp[--n];
+  return p;
+}
+
+inline char* mqtt_json_number(char* p, unsigned long long v, int) { return mqtt_json_digits(p, v); }
+inline char* mqtt_json_number(char* p, unsigned long v, int) { return mqtt_json_digits(p, v); }
+inline char* mqtt_json_number(char* p, unsigned v, int) { return mqtt_json_digits(p, v); }
+
+inline char* mqtt_json_number(char* p, long long v, int) {
+  if (v < 0) *p++ = '-';
+  return mqtt_json_digits(p, v < 0 ? 0 - (uint64_t)v : (uint64_t)v);
+}
+inline char* mqtt_json_number(char* p, long v, int places) { return mqtt_json_number(p, (long long)v, places); }
+inline char* mqtt_json_number(char* p, int v, int places) { return mqtt_json_number(p, (long long)v, places); }
+
+inline char* mqtt_json_number(char* p, bool v, int) {
+  memcpy(p, v ? "true" : "false", v ? 4 : 5);
+  return p + (v ? 4 : 5);
+}
+
+// The whole part and the fraction are split exactly, and only the fraction
+// is scaled, so the rounding is printf's but for values within an ulp of
+// halfway between two outputs.  F
+// is float or double; float stays in float, which the ESP32 does in
+// hardware.
+template <class F>
+char* mqtt_json_fixed(char* p, F v, uint64_t scale, int places) {
+  F a = v < 0 ? -v : v;
+  if (!(a < (F)9.2e18)) {  // NaN and infinities too
+    memcpy(p, "null", 4);
+    return p + 4;
+  }
+  uint64_t whole = (uint64_t)a;
+  F scaled = (a - (F)whole) * (F)scale;
+  uint64_t frac = (uint64_t)scaled;
+  F rest = scaled - (F)frac;
+  if (rest > (F)0.5 || (rest == (F)0.5 && (frac & 1))) frac++;  // ties to even, as printf
+  if (frac >= scale) whole++, frac -= scale;
+  if (v < 0 && (whole || frac)) *p++ = '-';
+  p = mqtt_json_digits(p, whole);
+  if (!places) return p;
+  *p++ = '.';
+  return mqtt_json_digits(p, frac, places);
+}
+
+template <class... Fields> class MqttJson;
+
+template <> class MqttJson<> {
+public:
+  enum { fields_size = 0 };
+  static char* put(char* p, char) { return p; }
+};
+
+template <class F, class... Rest>
+class MqttJson<F, Rest...> {
+public:
+  // The separator, the key and the longest value, for this field and the
+  // rest of them.
+  enum {
+    fields_size = 1 + F::key_len + MqttJsonWidth<typename F::value_type, F::places>::value +
+                  MqttJson<Rest...>::fields_size
+  };
+  // {, the fields, }, and the terminator.
+  static constexpr size_t max_size = fields_size + 2;
+
+  static size_t write(char* out, typename F::value_type v, typename Rest::value_type... rest) {
+    char* p = put(out, '{', v, rest...);
+    *p++ = '}';
+    *p = 0;
+    return p - out;
+  }
+
+  static char* put(char* p, char separator, typename F::value_type v, typename Rest::value_type... rest) {
+    *p++ = separator;
+    memcpy(p, F::key(), F::key_len);
+    p = value(p + F::key_len, v);
+    return MqttJson<Rest...>::put(p, ',', rest...);
+  }
+
+private:
+  template <class T>
+  static char* value(char* p, T v, typename std::enable_if<std::is_floating_point<T>::value>::type* = 0) {
+    return mqtt_json_fixed(p, v, MqttJsonPow10<F::places>::value, F::places);
+  }
+
+  template <class T>
+  static char* value(char* p, T v, typename std::enable_if<!std::is_floating_point<T>::value>::type* = 0) {
+    return mqtt_json_number(p, v, F::places);
+  }
+};
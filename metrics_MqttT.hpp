@@ -0,0 +1,140 @@
+// Self-telemetry for the MQTT templates.
+//
+// The library keeps a few counters and histograms about itself in
+// mqtt_metrics, and every metrics_interval_ms (0 = never) publishes them to
+// metrics_topic ("%s" is the MAC) as one line of compact JSON:
+//
+//   {"up":3600,"pub_us":{"n":1200,"sum":96000,"max":2100,"b":[0,0,0,4,...]},
+//    "loop_us":{...},"hs_ms":{...},"conn_ms":{...},"ack_ms":{...},"alias_b":{...},
+//    "attempts":3,"online":3,"fail":{"tcp":1},
+//    "heap_min":151234,"stack_free":6120,"loop_stack_free":5200}
+//
+//   pub_us     publish() calls made by the library: the publish queue, the
+//              store-and-forward replay, the metrics themselves
+//   loop_us    mqttClient.loop()
+//   hs_ms      TCP connect plus TLS handshake, for connections that made it
+//   conn_ms    start of an attempt (DNS) to online, for attempts that made it
+//   ack_ms     QoS 1 publishes (mqtt_qos1): sent to PUBACK
+//   alias_b    MQTT 5 publishes sent with a topic alias instead of the topic:
+//              bytes saved against MQTT 3.1.1
+//   fail       failed attempts, by the step they failed at (steps with none
+//              are left out)
+//   stack_free unused stack of the "Arduino Task" that runs loop1() (bytes
+//              on ESP32); loop_stack_free is the same for loop() itself, or
+//              for the network task with MQTTT_NET_TASK
+//
+// Everything counts from boot.  A histogram is "b", bucket counts where
+// bucket 0 is a value of 0 and bucket i holds values from 2^(i-1) up to
+// 2^i - 1; the last bucket also takes everything larger.  Trailing empty
+// buckets are left out.  Recording never allocates.
+//
+// Your own publishes can be timed into the same histogram:
+//
+//   uint32_t t0 = micros();
+//   mqttClient.publish(topic, value);
+//   mqtt_metrics.pub_us.record(micros() - t0);
+
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+
+// From the core.
+void mqtt_abort_publish();
+
+// Tunable from the sketch.
+uint32_t metrics_interval_ms = 60000;
+const char* metrics_topic = "%s/metrics";
+
+#ifndef MQTTT_METRICS_BUCKETS
+#define MQTTT_METRICS_BUCKETS 20
+#endif
+
+class MqttHistogram {
+public:
+  void record(uint32_t v) {
+    uint32_t b = v ? 32 - __builtin_clz(v) : 0;
+    if (b >= MQTTT_METRICS_BUCKETS) b = MQTTT_METRICS_BUCKETS - 1;
+    counts[b]++;
+    n++;
+    sum += v;
+    if (v > max) max = v;
+  }
+
+  uint32_t count() const { return n; }
+
+  // Appends {"n":..,"sum":..,"max":..,"b":[..]} to out; returns the length
+  // written, as snprintf would.
+  int format(char* out, size_t size) const {
+    int used = 0, last = MQTTT_METRICS_BUCKETS - 1;
+    while (last > 0 && counts[last] == 0) last--;
+    used += snprintf(out, size, "{\"n\":%u,\"sum\":%llu,\"max\":%u,\"b\":[", (unsigned)n,
+                     (unsigned long long)sum, (unsigned)max);
+    for (int i = 0; i <= last && (size_t)used < size; i++)
+      used += snprintf(out + used, size - used, i ? ",%u" : "%u", (unsigned)counts[i]);
+    if ((size_t)used < size) used += snprintf(out + used, size - used, "]}");
+    return used;
+  }
+
+private:
+  uint32_t counts[MQTTT_METRICS_BUCKETS] = {};
+  uint32_t n = 0, max = 0;
+  uint64_t sum = 0;
+};
+
+class MqttMetrics {
+public:
+  MqttHistogram pub_us, loop_us, hs_ms, conn_ms, ack_ms, alias_b;
+
+  // loop() publishes when this says it's time.
+  bool due() const { return metrics_interval_ms && (uint32_t)(millis() - last) >= metrics_interval_ms; }
+
+  // Conn is the MqttConnection, for its attempt and failure counts; task is
+  // the "Arduino Task" (or NULL if there isn't one).
+  template <class Conn>
+  void publish(PubSubClient& mqtt, const Conn& conn, const char* topic, TaskHandle_t task) {
+    last = millis();
+
+    char buf[1024];
+    int n = snprintf(buf, sizeof(buf), "{\"up\":%lu", (unsigned long)(millis() / 1000));
+    const struct { const char* name; const MqttHistogram& h; } hists[] = {
+      {"pub_us", pub_us}, {"loop_us", loop_us}, {"hs_ms", hs_ms}, {"conn_ms", conn_ms},
+      {"ack_ms", ack_ms}, {"alias_b", alias_b}
+    };
+    for (const auto& e : hists) {
+      if ((size_t)n >= sizeof(buf)) break;
+      n += snprintf(buf + n, sizeof(buf) - n, ",\"%s\":", e.name);
+      if ((size_t)n < sizeof(buf)) n += e.h.format(buf + n, sizeof(buf) - n);
+    }
+    if ((size_t)n < sizeof(buf))
+      n += snprintf(buf + n, sizeof(buf) - n, ",\"attempts\":%u,\"online\":%u,\"fail\":{",
+                    (unsigned)conn.stats().attempts, (unsigned)conn.stats().successes);
+    typedef decltype(conn.state()) State;
+    const uint32_t* fails = conn.failures();
+    bool first = true;
+    for (int s = 0; s < Conn::STATES && (size_t)n < sizeof(buf); s++) {
+      if (!fails[s]) continue;
+      n += snprintf(buf + n, sizeof(buf) - n, "%s\"%s\":%u", first ? "" : ",", Conn::name((State)s), (unsigned)fails[s]);
+      first = false;
+    }
+    if ((size_t)n < sizeof(buf))
+      n += snprintf(buf + n, sizeof(buf) - n, "},\"heap_min\":%u,\"stack_free\":%u,\"loop_stack_free\":%u}",
+                    (unsigned)ESP.getMinFreeHeap(), task ? (unsigned)uxTaskGetStackHighWaterMark(task) : 0,
+                    (unsigned)uxTaskGetStackHighWaterMark(NULL));
+    if ((size_t)n >= sizeof(buf)) return;  // can't happen with the default bucket count
+
+    // beginPublish() streams past PubSubClient's buffer, which is likely
+    // smaller than this.
+    uint32_t t0 = micros();
+    if (mqtt.beginPublish(topic, n, false)) {
+      // A short write leaves the PUBLISH half sent; see mqtt_abort_publish().
+      if (mqtt.write((const uint8_t*)buf, n) != (size_t)n) mqtt_abort_publish();
+      else if (mqtt.endPublish()) pub_us.record(micros() - t0);
+    }
+  }
+
+private:
+  uint32_t last = 0;
+};
+
+MqttMetrics mqtt_metrics;
@@ -0,0 +1,576 @@
+// MQTT 5 on the wire, for a client that speaks MQTT 3.1.1.
+//
+// PubSubClient only knows MQTT 3.1.1.  With mqtt5_enabled set, MqttWire
+// (wire_MqttT.hpp) runs everything through Mqtt5Codec instead: it rewrites
+// the packets PubSubClient (and mqtt_qos1) send into MQTT 5, and the
+// broker's MQTT 5 packets back into 3.1.1, so nothing above the wire
+// changes.  What that buys:
+//
+// Topic aliases.  Once the broker has said (in CONNACK) that it takes them,
+// the first publish to a topic carries the topic and an alias number, and
+// later publishes to it carry just the number: a 2-byte property instead of
+// a topic like "hello_world_0123456789AB/status".  Up to mqtt5_max_aliases
+// topics (at most MQTTT_MQTT5_ALIASES, and no more than the broker allows)
+// of up to MQTTT_MQTT5_ALIAS_TOPIC bytes get one; when they're all used,
+// the least recently used is given to the new topic.  The bytes each
+// aliased publish saved, against MQTT 3.1.1, go into the alias_b histogram
+// in the self-telemetry.
+//
+// Session expiry.  The broker keeps the session (its subscriptions, and QoS
+// 1 messages for this device) for mqtt5_session_expiry_s after the
+// connection drops.  When the device reconnects in time, CONNACK says the
+// session is still there and the connection skips resubscribing.  The first
+// connection after a boot always starts a clean session, so a new sketch's
+// subscriptions are never missed.
+//
+// Refusals.  An MQTT 5 PUBACK can carry a failure reason code (0x80 and
+// up: 0x87 not authorized, 0x97 quota exceeded, ...), which MQTT 3.1.1 has
+// no way to say.  Such a PUBACK isn't passed on as one: it's logged,
+// counted (mqtt_wire.mqtt5_rejected()), and handed to mqtt_qos1 as a failed
+// completion, which frees the message's slot and tells the sketch the
+// reason (see qos1_MqttT.hpp).  Sending it again wouldn't help.
+//
+// If the broker turns MQTT 5 down, mqtt5_enabled is cleared and the next
+// attempt uses 3.1.1.
+//
+//   void setup1() {
+//     mqtt5_enabled = true;
+//   }
+//
+// The buffers (about 3 KB with the defaults) are allocated the first time
+// MQTT 5 is used.
+
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+#include "metrics_MqttT.hpp"
+
+#ifndef MQTTT_MQTT5_ALIASES
+#define MQTTT_MQTT5_ALIASES 16
+#endif
+#ifndef MQTTT_MQTT5_ALIAS_TOPIC
+#define MQTTT_MQTT5_ALIAS_TOPIC 64
+#endif
+// The most of a packet's header (topic included) that's held while it's
+// rewritten.
+#ifndef MQTTT_MQTT5_HEAD
+#define MQTTT_MQTT5_HEAD 320
+#endif
+// Refusals held until mqtt_qos1 picks them up.
+#ifndef MQTTT_MQTT5_REFUSALS
+#define MQTTT_MQTT5_REFUSALS 16
+#endif
+
+// Tunable from the sketch.
+bool mqtt5_enabled = false;
+uint32_t mqtt5_session_expiry_s = 3600;  // 0: the broker drops the session with the connection
+uint8_t mqtt5_max_aliases = 16;
+
+class Mqtt5Codec {
+  static_assert(MQTTT_MQTT5_REFUSALS <= 128 && (MQTTT_MQTT5_REFUSALS & (MQTTT_MQTT5_REFUSALS - 1)) == 0,
+                "MQTTT_MQTT5_REFUSALS must be a power of two, at most 128");
+
+public:
+  // Starts translating a new connection.  False if the buffers couldn't be
+  // allocated (then the connection stays MQTT 3.1.1).
+  bool begin() {
+    if (!b && !(b = (Buffers*)malloc(sizeof(Buffers)))) return false;
+    on = true;
+    o_part = i_part = HDR;
+    staged = 0;
+    in_head = in_tail = 0;
+    n_alias = 0;
+    broker_aliases = 0;
+    return true;
+  }
+
+  void end() { on = false; }
+  bool active() const { return on; }
+
+  // PUBACKs (and PUBRECs) with a failure reason code, since boot.
+  uint32_t rejected() const { return n_rejected; }
+
+  // The packet id and reason code of a refusal not yet picked up, oldest
+  // first.
+  bool take_refusal(uint16_t& id, uint8_t& reason) {
+    if (ref_head == ref_tail) return false;
+    uint8_t i = ref_tail++ % MQTTT_MQTT5_REFUSALS;
+    id = refused_id[i];
+    reason = refused_why[i];
+    return true;
+  }
+
+  // --- Outgoing: MQTT 3.1.1 in, MQTT 5 out ---
+
+  // Returns size, or 0 if the connection wouldn't take it all.
+  size_t send(Client& net, const uint8_t* buf, size_t size) {
+    ok = true;
+    net_now = &net;
+    for (size_t i = 0; i < size && ok;) i += out_feed(net, buf + i, size - i);
+    flush(net);
+    if (ok) return size;
+    // Part of a packet may have gone out: the stream can't be continued.
+    net.stop();
+    return 0;
+  }
+
+  // --- Incoming: MQTT 5 in, MQTT 3.1.1 out ---
+
+  int available(Client& net) {
+    pump(net);
+    return in_head - in_tail;
+  }
+
+  int read(Client& net) {
+    pump(net);
+    if (in_head == in_tail) return -1;
+    return b->in[in_tail++ % sizeof(b->in)];
+  }
+
+  int peek(Client& net) {
+    pump(net);
+    return in_head == in_tail ? -1 : b->in[in_tail % sizeof(b->in)];
+  }
+
+private:
+  enum { HDR, LEN, HEAD, PLEN, PROPS, REST };
+  enum { CONNECT = 1, CONNACK, PUBLISH, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBSCRIBE, SUBACK,
+         UNSUBSCRIBE, UNSUBACK, PINGREQ, PINGRESP, DISCONNECT, AUTH };
+
+  struct Alias {
+    uint8_t len;
+    char topic[MQTTT_MQTT5_ALIAS_TOPIC];
+    uint32_t used;
+  };
+
+  struct Buffers {
+    uint8_t out[512];                // staged for the next net.write()
+    uint8_t in[1024];                // translated, for PubSubClient to read
+    uint8_t o_head[MQTTT_MQTT5_HEAD];
+    uint8_t i_head[MQTTT_MQTT5_HEAD];
+    Alias alias[MQTTT_MQTT5_ALIASES];
+  };
+
+  // Outgoing packets: the fixed header is read, then the part that changes
+  // (o_need bytes) is held in o_head and rewritten, and the rest is passed
+  // on as it comes.
+  size_t out_feed(Client& net, const uint8_t* p, size_t n) {
+    switch (o_part) {
+      case HDR:
+        o_type = p[0];
+        o_rem = 0;
+        o_shift = 0;
+        o_part = LEN;
+        return 1;
+
+      case LEN:
+        o_rem |= (uint32_t)(p[0] & 0x7F) << o_shift;
+        o_shift += 7;
+        if (!(p[0] & 0x80)) {
+          o_len = 0;
+          uint8_t t = o_type >> 4;
+          o_need = t == CONNECT ? 12 : t == PUBLISH || t == SUBSCRIBE || t == UNSUBSCRIBE ? 2 : 0;
+          if (o_need > o_rem) o_need = 0;  // malformed; let the broker say so
+          if (o_need) o_part = HEAD;
+          else {
+            stage_header(o_type, o_rem);
+            o_part = o_rem ? REST : HDR;
+          }
+        }
+        return 1;
+
+      case HEAD: {
+        size_t k = o_need - o_len < n ? o_need - o_len : n;
+        memcpy(b->o_head + o_len, p, k);
+        o_len += k;
+        if (o_len == o_need) {
+          // Now the length of the variable part is known.
+          uint8_t t = o_type >> 4;
+          if (t == CONNECT && o_need == 12) o_need = 12 + (b->o_head[10] << 8 | b->o_head[11]);
+          else if (t == PUBLISH && o_need == 2)
+            o_need = 2 + (b->o_head[0] << 8 | b->o_head[1]) + ((o_type & 0x06) ? 2 : 0);
+          if (o_need > MQTTT_MQTT5_HEAD || o_need > o_rem) {
+            Serial.println("MQTT 5: packet header too long to translate");
+            ok = false;
+            return k;
+          }
+          if (o_len == o_need) {
+            rewrite();
+            o_rem -= o_len;
+            o_part = o_rem ? REST : HDR;
+          }
+        }
+        return k;
+      }
+
+      default: {  // REST
+        size_t k = o_rem < n ? o_rem : n;
+        stage(net, p, k);
+        o_rem -= k;
+        if (!o_rem) o_part = HDR;
+        return k;
+      }
+    }
+  }
+
+  void rewrite() {
+    const uint8_t* h = b->o_head;
+    uint8_t props[8];
+    size_t n_props = 0;
+    switch (o_type >> 4) {
+      case CONNECT: {
+        // Protocol level 5, Clean Start unless a session can be resumed,
+        // Session Expiry Interval, and (empty) will properties.
+        bool will = h[7] & 0x04;
+        bool clean = fresh_boot || mqtt5_session_expiry_s == 0;
+        if (mqtt5_session_expiry_s) {
+          props[n_props++] = 0x11;
+          for (int i = 3; i >= 0; i--) props[n_props++] = mqtt5_session_expiry_s >> (8 * i);
+        }
+        stage_header(o_type, o_rem + 1 + n_props + (will ? 1 : 0));
+        uint8_t vh[8];
+        memcpy(vh, h, 8);
+        vh[6] = 5;
+        vh[7] = clean ? (h[7] | 0x02) : (h[7] & ~0x02);
+        stage(vh, 8);
+        stage(h + 8, 2);  // keep alive
+        stage_varint(n_props);
+        stage(props, n_props);
+        stage(h + 10, o_len - 10);  // client id
+        if (will) stage_varint(0);
+        break;
+      }
+
+      case PUBLISH: {
+        size_t topic_len = h[0] << 8 | h[1];
+        size_t tail = o_len - 2 - topic_len;  // the packet id, if QoS > 0
+        int hit = -1, alias = alias_for(h + 2, topic_len, hit);
+        bool send_topic = hit < 0;
+        if (alias > 0) {
+          props[n_props++] = 0x23;  // Topic Alias
+          props[n_props++] = alias >> 8;
+          props[n_props++] = alias;
+        }
+        if (!send_topic) mqtt_metrics.alias_b.record(topic_len - 1 - n_props);
+        stage_header(o_type, o_rem - (send_topic ? 0 : topic_len) + 1 + n_props);
+        uint8_t len[2] = {(uint8_t)(send_topic ? h[0] : 0), (uint8_t)(send_topic ? h[1] : 0)};
+        stage(len, 2);
+        if (send_topic) stage(h + 2, topic_len);
+        stage(h + 2 + topic_len, tail);
+        stage_varint(n_props);
+        stage(props, n_props);
+        break;
+      }
+
+      default:  // SUBSCRIBE, UNSUBSCRIBE: the packet id, then no properties
+        stage_header(o_type, o_rem + 1);
+        stage(h, 2);
+        stage_varint(0);
+        break;
+    }
+  }
+
+  // The alias to send with a topic (0 for none).  hit is set when the
+  // broker already has it, so the topic can be left out.
+  int alias_for(const uint8_t* topic, size_t len, int& hit) {
+    uint8_t limit = mqtt5_max_aliases;
+    if (limit > MQTTT_MQTT5_ALIASES) limit = MQTTT_MQTT5_ALIASES;
+    if (limit > broker_aliases) limit = broker_aliases;
+    // Not worth it unless the topic is longer than the property.
+    if (!limit || len <= 4 || len > MQTTT_MQTT5_ALIAS_TOPIC) return 0;
+    lru_clock++;
+    int oldest = 0;
+    for (int i = 0; i < n_alias; i++) {
+      Alias& a = b->alias[i];
+      if (a.len == len && memcmp(a.topic, topic, len) == 0) {
+        a.used = lru_clock;
+        hit = i;
+        return i + 1;
+      }
+      if (a.used < b->alias[oldest].used) oldest = i;
+    }
+    int i = n_alias < limit ? n_alias++ : oldest;
+    b->alias[i].len = len;
+    memcpy(b->alias[i].topic, topic, len);
+    b->alias[i].used = lru_clock;
+    return i + 1;
+  }
+
+  void stage_header(uint8_t type, uint32_t remaining) {
+    stage(&type, 1);
+    stage_varint(remaining);
+  }
+
+  void stage_varint(uint32_t v) {
+    uint8_t buf[4];
+    size_t n = 0;
+    do {
+      buf[n] = v & 0x7F;
+      v >>= 7;
+      if (v) buf[n] |= 0x80;
+      n++;
+    } while (v && n < 4);
+    stage(buf, n);
+  }
+
+  void stage(const uint8_t* p, size_t n) { stage(*net_now, p, n); }
+
+  void stage(Client& net, const uint8_t* p, size_t n) {
+    net_now = &net;
+    if (staged + n > sizeof(b->out)) flush(net);
+    if (n > sizeof(b->out)) {
+      if (net.write(p, n) != n) ok = false;
+      return;
+    }
+    memcpy(b->out + staged, p, n);
+    staged += n;
+  }
+
+  void flush(Client& net) {
+    if (staged && net.write(b->out, staged) != staged) ok = false;
+    staged = 0;
+  }
+
+  // Incoming packets: like outgoing, the fixed part of the variable header
+  // (i_need bytes) is held, the properties are read (CONNACK's) or skipped,
+  // then the 3.1.1 packet is put out and the rest passed on, or dropped.
+  void pump(Client& net) {
+    net_now = &net;
+    while (sizeof(b->in) - (in_head - in_tail) >= MQTTT_MQTT5_HEAD + 16 && net.available() > 0) {
+      int c = net.read();
+      if (c < 0) break;
+      in_feed((uint8_t)c);
+    }
+  }
+
+  void in_feed(uint8_t c) {
+    switch (i_part) {
+      case HDR:
+        i_type = c;
+        i_rem = 0;
+        i_shift = 0;
+        i_part = LEN;
+        return;
+
+      case LEN:
+        i_rem |= (uint32_t)(c & 0x7F) << i_shift;
+        i_shift += 7;
+        if (c & 0x80) {
+          if (i_shift > 21) broken();
+          return;
+        }
+        i_len = 0;
+        i_plen = 0;
+        i_pshift = 0;
+        switch (i_type >> 4) {
+          case CONNACK: i_need = 2; break;  // flags, reason code
+          case PUBLISH: i_need = 2; break;  // then the topic and packet id
+          case PUBACK: case PUBREC: case PUBREL: case PUBCOMP:
+            i_need = i_rem < 3 ? i_rem : 3;  // packet id, reason code
+            break;
+          case SUBACK: case UNSUBACK: i_need = 2; break;
+          case DISCONNECT: case AUTH: i_need = i_rem ? 1 : 0; break;
+          default:  // PINGRESP
+            push(i_type);
+            push_varint(i_rem);
+            i_part = i_rem ? REST : HDR;
+            i_pass = true;
+            return;
+        }
+        if (i_need > i_rem) i_need = i_rem;
+        i_part = HEAD;
+        if (!i_need) after_head();
+        return;
+
+      case HEAD:
+        b->i_head[i_len++] = c;
+        i_rem--;
+        if (i_len == i_need && (i_type >> 4) == PUBLISH && i_need == 2) {
+          i_need = 2 + (b->i_head[0] << 8 | b->i_head[1]) + ((i_type & 0x06) ? 2 : 0);
+          if (i_need > MQTTT_MQTT5_HEAD || i_need > i_rem + i_len) return broken();
+        }
+        if (i_len == i_need) after_head();
+        return;
+
+      case PLEN:
+        i_plen |= (uint32_t)(c & 0x7F) << i_pshift;
+        i_pshift += 7;
+        i_rem--;
+        if (c & 0x80) return;
+        if (i_plen > i_rem) return broken();
+        i_props = 0;
+        if (i_plen) i_part = PROPS;
+        else emit();
+        return;
+
+      case PROPS:
+        // Only CONNACK's are looked at; the rest are skipped.
+        if ((i_type >> 4) == CONNACK && i_len + i_props < MQTTT_MQTT5_HEAD) b->i_head[i_len + i_props] = c;
+        i_props++;
+        i_rem--;
+        if (i_props == i_plen) emit();
+        return;
+
+      default:  // REST
+        i_rem--;
+        if (i_pass) push(c);
+        else if ((i_type >> 4) == SUBACK) push(c >= 0x80 ? 0x80 : c);
+        if (!i_rem) i_part = HDR;
+        return;
+    }
+  }
+
+  // The fixed fields are in; properties follow if there's anything left.
+  void after_head() {
+    uint8_t t = i_type >> 4;
+    bool has_props = i_rem && ((t != PUBACK && t != PUBREC && t != PUBREL && t != PUBCOMP) || i_len == 3);
+    if (has_props) i_part = PLEN;
+    else emit();
+  }
+
+  void emit() {
+    const uint8_t* h = b->i_head;
+    i_pass = false;
+    switch (i_type >> 4) {
+      case CONNACK: {
+        uint8_t code = i_len > 1 ? h[1] : 0;
+        if (code == 0) {
+          parse_connack_props(h + i_len, i_plen < MQTTT_MQTT5_HEAD - i_len ? i_plen : 0);
+          fresh_boot = false;
+        }
+        if (code == 0x01 || code == 0x84) {
+          Serial.println("MQTT 5: the broker doesn't support it; using MQTT 3.1.1");
+          mqtt5_enabled = false;
+        }
+        push(0x20);
+        push(2);
+        push(i_len ? h[0] : 0);
+        push(connack_code(code));
+        break;
+      }
+
+      case PUBLISH:
+        push(i_type);
+        push_varint(i_len + i_rem);
+        for (size_t i = 0; i < i_len; i++) push(h[i]);
+        i_pass = true;
+        break;
+
+      case PUBACK: case PUBREC:
+        if (i_len > 2 && h[2] >= 0x80) {
+          // Refused (see the top of this file): not passed on as a PUBACK.
+          n_rejected++;
+          Serial.printf("MQTT 5: the broker refused message %u, reason 0x%02X\n", (unsigned)(h[0] << 8 | h[1]), h[2]);
+          if ((uint8_t)(ref_head - ref_tail) < MQTTT_MQTT5_REFUSALS) {
+            refused_id[ref_head % MQTTT_MQTT5_REFUSALS] = h[0] << 8 | h[1];
+            refused_why[ref_head++ % MQTTT_MQTT5_REFUSALS] = h[2];
+          }
+          break;
+        }
+        // fall through
+      case PUBREL: case PUBCOMP: case UNSUBACK:
+        push(i_type);
+        push(2);
+        push(h[0]);
+        push(h[1]);
+        break;
+
+      case SUBACK:
+        push(i_type);
+        push_varint(2 + i_rem);
+        push(h[0]);
+        push(h[1]);
+        break;
+
+      case DISCONNECT:
+        Serial.printf("MQTT 5: broker disconnected, reason 0x%02X\n", i_len ? h[0] : 0);
+        break;
+
+      default:  // AUTH: not used
+        break;
+    }
+    i_part = i_rem ? REST : HDR;
+  }
+
+  void parse_connack_props(const uint8_t* p, size_t n) {
+    for (size_t i = 0; i < n;) {
+      uint8_t id = p[i++];
+      size_t len;
+      switch (id) {
+        case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A: len = 1; break;
+        case 0x13: case 0x21: case 0x22: case 0x23: len = 2; break;
+        case 0x02: case 0x11: case 0x18: case 0x27: len = 4; break;
+        case 0x0B:
+          len = 1;
+          while (i + len - 1 < n && (p[i + len - 1] & 0x80)) len++;
+          break;
+        case 0x26:  // string pair
+          if (i + 2 > n) return;
+          len = 2 + (p[i] << 8 | p[i + 1]);
+          if (i + len + 2 > n) return;
+          len += 2 + (p[i + len] << 8 | p[i + len + 1]);
+          break;
+        default:  // strings and binary data
+          if (i + 2 > n) return;
+          len = 2 + (p[i] << 8 | p[i + 1]);
+          break;
+      }
+      if (i + len > n) return;
+      if (id == 0x22) broker_aliases = p[i] << 8 | p[i + 1];  // Topic Alias Maximum
+      i += len;
+    }
+  }
+
+  // MQTT 5 reason codes, as the nearest MQTT 3.1.1 CONNACK return code.
+  static uint8_t connack_code(uint8_t code) {
+    switch (code) {
+      case 0x00: return 0;
+      case 0x84: return 1;               // unsupported protocol version
+      case 0x85: return 2;               // client identifier not valid
+      case 0x86: return 4;               // bad user name or password
+      case 0x87: case 0x8C: return 5;    // not authorized, bad authentication method
+      default: return code < 0x80 ? code : 3;  // server unavailable
+    }
+  }
+
+  void push(uint8_t c) { b->in[in_head++ % sizeof(b->in)] = c; }
+
+  void push_varint(uint32_t v) {
+    do {
+      uint8_t c = v & 0x7F;
+      v >>= 7;
+      push(v ? c | 0x80 : c);
+    } while (v);
+  }
+
+  // Something that can't be translated: the connection can't continue.
+  void broken() {
+    Serial.println("MQTT 5: malformed packet from the broker");
+    net_now->stop();
+    i_part = HDR;
+  }
+
+  Buffers* b = NULL;
+  bool on = false, ok = true;
+  bool fresh_boot = true;
+  Client* net_now = NULL;
+  uint32_t n_rejected = 0;
+  uint16_t refused_id[MQTTT_MQTT5_REFUSALS];
+  uint8_t refused_why[MQTTT_MQTT5_REFUSALS];
+  uint8_t ref_head = 0, ref_tail = 0;
+
+  uint8_t o_part = HDR, o_type = 0, o_shift = 0;
+  uint32_t o_rem = 0;
+  size_t o_len = 0, o_need = 0, staged = 0;
+
+  uint8_t i_part = HDR, i_type = 0, i_shift = 0, i_pshift = 0;
+  uint32_t i_rem = 0, i_plen = 0, i_props = 0;
+  size_t i_len = 0, i_need = 0;
+  bool i_pass = false;
+  uint32_t in_head = 0, in_tail = 0;
+
+  uint8_t n_alias = 0;
+  uint16_t broker_aliases = 0;
+  uint32_t lru_clock = 0;
+};
@@ -0,0 +1,140 @@
+// The networking in a task of its own (opt-in).
+//
+// By default loop() does everything in turn: WiFi/Ethernet, the broker
+// connection, mqttClient.loop(), OTA, the publish queue, and then
+// connectedLoop().  A slow sensor read in connectedLoop() holds up
+// keepalives, and a network stall holds up sensing.  With
+//
+//   #define MQTTT_NET_TASK
+//   #include "AtomS3_Mqtt.hpp"
+//
+// setup() starts an "MQTT Network" task that does the networking, and
+// loop() only calls connectedLoop() (while online, or always with
+// collect_while_offline).  connectedLoop() can hand its messages across
+// with mqtt_enqueue() (and PublishedValue<T>, which uses it), which never
+// waits: the publish queue is shared between the tasks, and mqtt_enqueue()
+// is safe from any task, loop1() included.
+//
+// mqttClient's publish(), beginPublish() ... endPublish(), subscribe() and
+// unsubscribe() can be called from any task too: mqttClient is an
+// MqttSharedClient (below), and the network task holds its lock for each
+// pass, so a direct publish waits for the pass in progress to end.
+//
+// Everything else that talks to the broker belongs to the network task:
+// mqttClient.loop(), mqtt_batch, mqtt_stream and mqtt_subscriptions.on()
+// after startup.  Incoming messages are handled there too, unless
+// inbound_mode moves them (see inbound_MqttT.hpp).  The task watchdog
+// watches the network task instead of loop().
+//
+//   #define MQTTT_NET_CORE 1        // default: the core loop() runs on
+//   #define MQTTT_NET_PRIORITY 3    // default 2, above loop()'s 1
+//   #define MQTTT_NET_STACK 10240   // bytes; default 8192, as loop() has
+//
+// Being above loop()'s priority on the same core, the network task takes
+// the CPU whenever it has work and connectedLoop() gets the rest.  The
+// loop1() task goes on the other core (see tasks_MqttT.hpp).
+
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <esp_task_wdt.h>
+
+#ifndef MQTTT_NET_STACK
+#define MQTTT_NET_STACK 8192
+#endif
+#ifndef MQTTT_NET_PRIORITY
+#define MQTTT_NET_PRIORITY 2
+#endif
+
+// The network task's core: MQTTT_NET_CORE, or the caller's (setup() runs
+// where loop() will).
+inline BaseType_t mqtt_net_core() {
+#if defined(MQTTT_NET_CORE)
+  return MQTTT_NET_CORE < 0 ? tskNO_AFFINITY : MQTTT_NET_CORE;
+#else
+  return xPortGetCoreID();
+#endif
+}
+
+// Starts the "MQTT Network" task running step() over and over.
+inline bool mqtt_start_net_task(void (*step)(), TaskHandle_t* handle) {
+  if (xTaskCreatePinnedToCore(
+          [](void* step) {
+            esp_task_wdt_add(NULL);
+            while (true) {
+              ((void (*)())step)();
+              vTaskDelay(1);  // let loop() in
+            }
+          },
+          "MQTT Network", MQTTT_NET_STACK, (void*)step, MQTTT_NET_PRIORITY, handle, mqtt_net_core()) == pdPASS)
+    return true;
+  Serial.printf("MQTT Network: couldn't start its task (%u byte stack)\n", (unsigned)MQTTT_NET_STACK);
+  return false;
+}
+
+// PubSubClient, with the calls that send taking a lock once share() has
+// been called (by setup(), with MQTTT_NET_TASK).  The lock is recursive, so
+// a message handler running inside the network task's pass can publish.
+// beginPublish() keeps it until endPublish(): write the payload from the
+// same task, and always finish with endPublish().
+class MqttSharedClient : public PubSubClient {
+public:
+  explicit MqttSharedClient(Client& client) : PubSubClient(client) {}
+
+  // False if the lock couldn't be created.
+  bool share() {
+    if (!lock) lock = xSemaphoreCreateRecursiveMutex();
+    return lock != NULL;
+  }
+
+  void take() {
+    if (lock) xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+  }
+  void give() {
+    if (lock) xSemaphoreGiveRecursive(lock);
+  }
+
+  // Holds the lock for a scope, e.g. for state the network task's pass
+  // also touches.
+  struct Held {
+    explicit Held(MqttSharedClient& c) : c(c) { c.take(); }
+    ~Held() { c.give(); }
+    MqttSharedClient& c;
+  };
+
+  template <class... A> bool publish(A... a) {
+    Held h(*this);
+    return PubSubClient::publish(a...);
+  }
+  template <class... A> bool publish_P(A... a) {
+    Held h(*this);
+    return PubSubClient::publish_P(a...);
+  }
+  template <class... A> bool subscribe(A... a) {
+    Held h(*this);
+    return PubSubClient::subscribe(a...);
+  }
+  template <class... A> bool unsubscribe(A... a) {
+    Held h(*this);
+    return PubSubClient::unsubscribe(a...);
+  }
+
+  bool beginPublish(const char* topic, unsigned int length, bool retained) {
+    take();
+    if (PubSubClient::beginPublish(topic, length, retained)) return true;
+    give();
+    return false;
+  }
+  int endPublish() {
+    int r = PubSubClient::endPublish();
+    give();
+    return r;
+  }
+
+private:
+  SemaphoreHandle_t lock = NULL;
+};
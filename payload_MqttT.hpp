@@ -0,0 +1,179 @@
+// Binary payloads: CBOR or MessagePack, written straight into a buffer.
+//
+// The JSON-by-snprintf pattern ("{\"temperature\":%.1f,...}") formats
+// every float as text, which is slow on the ESP32 (no FPU for doubles,
+// and printf's float code is large), and sends several bytes per digit.
+// MqttPayload writes the same structure in CBOR (RFC 8949) or MessagePack:
+// numbers as binary, floats as 4 bytes, nothing allocated.
+//
+//   uint8_t buf[64];
+//   MqttPayload p(buf, sizeof(buf));  // CBOR; MqttPayload(buf, size, MQTT_MSGPACK) for MessagePack
+//   p.map(3)
+//     .add("temperature", readTemp())
+//     .add("humidity", readHumidity())
+//     .add("pressure", readPressure());
+//   if (p.ok()) mqttClient.publish("sensors/all", p.data(), p.size(), true);
+//
+// map(n) and array(n) start a container of n entries (pairs, for a map);
+// what follows fills it, nested containers included.  add(key, v) is
+// key(key).value(v).  Integers take the fewest bytes that hold them, float
+// stays 4 bytes and double 8.  If the buffer runs out, ok() is false and
+// the payload must not be sent; nothing is written past the end.  reset()
+// starts over in the same buffer.
+//
+// extras/payload_decode.py turns either format back into JSON on the
+// receiving side.
+
+#pragma once
+
+#include <Arduino.h>
+
+enum MqttPayloadFormat : uint8_t { MQTT_CBOR, MQTT_MSGPACK };
+
+class MqttPayload {
+public:
+  MqttPayload(uint8_t* buf, size_t size, MqttPayloadFormat format = MQTT_CBOR)
+      : buf(buf), cap(size), format(format) {}
+
+  MqttPayload& map(size_t pairs) {
+    if (format == MQTT_CBOR) head(5, pairs);
+    else container(pairs, 0x80, 0xDE);
+    return *this;
+  }
+
+  MqttPayload& array(size_t items) {
+    if (format == MQTT_CBOR) head(4, items);
+    else container(items, 0x90, 0xDC);
+    return *this;
+  }
+
+  MqttPayload& key(const char* k) { return value(k); }
+
+  MqttPayload& value(long long v) {
+    if (v >= 0) return value((unsigned long long)v);
+    if (format == MQTT_CBOR) head(1, (uint64_t)(-1 - v));
+    else if (v >= -32) put((uint8_t)v);  // negative fixint
+    else if (v >= INT8_MIN) put(0xD0), be(v, 1);
+    else if (v >= INT16_MIN) put(0xD1), be(v, 2);
+    else if (v >= INT32_MIN) put(0xD2), be(v, 4);
+    else put(0xD3), be(v, 8);
+    return *this;
+  }
+
+  MqttPayload& value(unsigned long long v) {
+    if (format == MQTT_CBOR) head(0, v);
+    else if (v < 0x80) put((uint8_t)v);  // positive fixint
+    else if (v <= 0xFF) put(0xCC), be(v, 1);
+    else if (v <= 0xFFFF) put(0xCD), be(v, 2);
+    else if (v <= 0xFFFFFFFF) put(0xCE), be(v, 4);
+    else put(0xCF), be(v, 8);
+    return *this;
+  }
+
+  MqttPayload& value(int v) { return value((long long)v); }
+  MqttPayload& value(long v) { return value((long long)v); }
+  MqttPayload& value(unsigned v) { return value((unsigned long long)v); }
+  MqttPayload& value(unsigned long v) { return value((unsigned long long)v); }
+
+  MqttPayload& value(bool v) {
+    put(format == MQTT_CBOR ? (v ? 0xF5 : 0xF4) : (v ? 0xC3 : 0xC2));
+    return *this;
+  }
+
+  MqttPayload& value(float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, 4);
+    put(format == MQTT_CBOR ? 0xFA : 0xCA);
+    be(bits, 4);
+    return *this;
+  }
+
+  MqttPayload& value(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, 8);
+    put(format == MQTT_CBOR ? 0xFB : 0xCB);
+    be(bits, 8);
+    return *this;
+  }
+
+  MqttPayload& value(const char* s) { return text(s, strlen(s)); }
+
+  MqttPayload& text(const char* s, size_t len) {
+    if (format == MQTT_CBOR) head(3, len);
+    else if (len < 32) put(0xA0 | len);
+    else if (len <= 0xFF) put(0xD9), be(len, 1);
+    else if (len <= 0xFFFF) put(0xDA), be(len, 2);
+    else put(0xDB), be(len, 4);
+    return raw(s, len);
+  }
+
+  MqttPayload& bytes(const void* p, size_t len) {
+    if (format == MQTT_CBOR) head(2, len);
+    else if (len <= 0xFF) put(0xC4), be(len, 1);
+    else if (len <= 0xFFFF) put(0xC5), be(len, 2);
+    else put(0xC6), be(len, 4);
+    return raw(p, len);
+  }
+
+  MqttPayload& null() {
+    put(format == MQTT_CBOR ? 0xF6 : 0xC0);
+    return *this;
+  }
+
+  template <class T>
+  MqttPayload& add(const char* k, T v) {
+    return key(k).value(v);
+  }
+
+  const uint8_t* data() const { return buf; }
+  size_t size() const { return used; }
+  bool ok() const { return !overflow; }
+
+  void reset() {
+    used = 0;
+    overflow = false;
+  }
+
+private:
+  // CBOR's initial byte: major type and the argument (a count, length or
+  // the integer itself) in as few bytes as it fits.
+  void head(uint8_t major, uint64_t v) {
+    major <<= 5;
+    if (v < 24) put(major | v);
+    else if (v <= 0xFF) put(major | 24), be(v, 1);
+    else if (v <= 0xFFFF) put(major | 25), be(v, 2);
+    else if (v <= 0xFFFFFFFF) put(major | 26), be(v, 4);
+    else put(major | 27), be(v, 8);
+  }
+
+  // MessagePack: fix (up to 15 entries), 16 or 32 bit count.
+  void container(size_t n, uint8_t fix, uint8_t c16) {
+    if (n < 16) put(fix | n);
+    else if (n <= 0xFFFF) put(c16), be(n, 2);
+    else put(c16 + 1), be(n, 4);
+  }
+
+  void put(uint8_t b) {
+    if (used < cap) buf[used++] = b;
+    else overflow = true;
+  }
+
+  void be(uint64_t v, int n) {
+    if (used + n > cap) {
+      overflow = true;
+      return;
+    }
+    for (int i = n - 1; i >= 0; i--) buf[used++] = v >> (8 * i);
+  }
+
+  MqttPayload& raw(const void* p, size_t len) {
+    if (used + len > cap) overflow = true;
+    else memcpy(buf + used, p, len), used += len;
+    return *this;
+  }
+
+  uint8_t* buf;
+  size_t cap, used = 0;
+  MqttPayloadFormat format;
+  bool overflow = false;
+};
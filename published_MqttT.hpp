@@ -0,0 +1,93 @@
+// PublishedValue<T>: the "publish when it changes, but at least every ~10
+// seconds" pattern (see AI_GUIDANCE.md) without the statics and millis()
+// bookkeeping in every sketch.
+//
+//   PublishedValue<float> temperature("sensors/%s/temperature", 0.2);  // deadband 0.2
+//
+//   void connectedLoop() {
+//     temperature.update(read_temperature());
+//   }
+//
+// update() publishes (through mqtt_enqueue(), so it doesn't block) when
+//   - nothing has been published yet,
+//   - the value has moved by more than the deadband since it was last
+//     published and min_interval_ms has passed since then, or
+//   - heartbeat_ms has passed since then, whatever the value.
+// Otherwise it's a compare and returns false.  A change that arrives inside
+// min_interval_ms goes out on the first update() after it, if it's still
+// there.
+//
+// Values are published as text: integers as they are, floats with
+// `decimals` digits after the point, bools as 0/1.  For other types,
+// overload mqtt_format_value().  The topic goes through mqtt_topics (%s is
+// the MAC).
+
+#pragma once
+
+#include <Arduino.h>
+#include "pubqueue_MqttT.hpp"
+#include "topics_MqttT.hpp"
+
+inline int mqtt_format_value(char* buf, size_t size, long v, uint8_t) { return snprintf(buf, size, "%ld", v); }
+inline int mqtt_format_value(char* buf, size_t size, unsigned long v, uint8_t) { return snprintf(buf, size, "%lu", v); }
+inline int mqtt_format_value(char* buf, size_t size, int v, uint8_t) { return snprintf(buf, size, "%d", v); }
+inline int mqtt_format_value(char* buf, size_t size, unsigned v, uint8_t) { return snprintf(buf, size, "%u", v); }
+inline int mqtt_format_value(char* buf, size_t size, long long v, uint8_t) { return snprintf(buf, size, "%lld", v); }
+inline int mqtt_format_value(char* buf, size_t size, unsigned long long v, uint8_t) {
+  return snprintf(buf, size, "%llu", v);
+}
+inline int mqtt_format_value(char* buf, size_t size, bool v, uint8_t) { return snprintf(buf, size, "%d", v ? 1 : 0); }
+inline int mqtt_format_value(char* buf, size_t size, double v, uint8_t decimals) {
+  return snprintf(buf, size, "%.*f", decimals, v);
+}
+inline int mqtt_format_value(char* buf, size_t size, float v, uint8_t decimals) {
+  return mqtt_format_value(buf, size, (double)v, decimals);
+}
+
+template <class T>
+class PublishedValue {
+public:
+  PublishedValue(const char* topic, T deadband = T(), uint32_t min_interval_ms = 2000,
+                 uint32_t heartbeat_ms = 10000, bool retained = true, uint8_t decimals = 2)
+    : topic(mqtt_topics.add(topic)), deadband(deadband), min_interval_ms(min_interval_ms),
+      heartbeat_ms(heartbeat_ms), retained(retained), decimals(decimals) {}
+
+  // Returns true if v was queued for publishing.
+  bool update(const T& v) {
+    uint32_t since = millis() - last_ms;
+    if (have && since < heartbeat_ms && (since < min_interval_ms || !moved(v))) return false;
+    return publish(v);
+  }
+
+  // Publishes on the next update() no matter what, e.g. after a reconnect.
+  void force() { have = false; }
+
+  const T& last_published() const { return last; }
+
+private:
+  bool moved(const T& v) const {
+    // NaN isn't > or < anything, so going to or from NaN counts as a change.
+    if (v != v || last != last) return (v != v) != (last != last);
+    return (v > last ? v - last : last - v) > deadband;
+  }
+
+  bool publish(const T& v) {
+    char buf[32];
+    int n = mqtt_format_value(buf, sizeof(buf), v, decimals);
+    if (n < 0 || n >= (int)sizeof(buf)) return false;
+    if (!mqtt_enqueue(mqtt_topics[topic], (const uint8_t*)buf, n, retained)) return false;
+    last = v;
+    last_ms = millis();
+    have = true;
+    return true;
+  }
+
+  MqttTopic topic;
+  T deadband;
+  uint32_t min_interval_ms, heartbeat_ms;
+  bool retained;
+  uint8_t decimals;
+  T last = T();
+  uint32_t last_ms = 0;
+  bool have = false;
+};
@@ -0,0 +1,331 @@
+// Outbound publish queue for the MQTT templates.
+//
+// mqttClient.publish() can block the networking thread for seconds when the
+// link is bad.  mqtt_enqueue() instead copies the topic and payload into a
+// fixed-size arena and returns immediately.  loop() drains the queue after
+// each mqttClient.loop(), and stops starting new publishes once
+// publish_queue_budget_ms has been spent in that pass.
+//
+// When the arena is full, publish_queue_policy decides what gives:
+//   MQTT_DROP_OLDEST        - discard the oldest queued messages (default)
+//   MQTT_DROP_NEWEST        - refuse the new message (mqtt_enqueue returns false)
+//   MQTT_COALESCE_BY_TOPIC  - a queued message on the same topic is replaced by
+//                             the new one, so only the latest value per topic is
+//                             kept.  Falls back to dropping the oldest if that
+//                             still doesn't make room.
+//
+// The queue belongs to the networking thread: call mqtt_enqueue() from
+// connectedLoop(), not from loop1().  With the network task (MQTTT_NET_TASK,
+// see nettask_MqttT.hpp) the queue is shared, and mqtt_enqueue() is safe
+// from any task.
+//
+// The arena size is fixed at compile time; #define MQTTT_PUBQUEUE_BYTES before
+// including your board's *_Mqtt.hpp to change it.
+
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "metrics_MqttT.hpp"
+
+#ifndef MQTTT_PUBQUEUE_BYTES
+#define MQTTT_PUBQUEUE_BYTES 4096
+#endif
+static_assert(MQTTT_PUBQUEUE_BYTES < 65536, "MQTTT_PUBQUEUE_BYTES must fit in 16 bits");
+
+enum MqttOverflowPolicy {
+  MQTT_DROP_OLDEST,
+  MQTT_DROP_NEWEST,
+  MQTT_COALESCE_BY_TOPIC
+};
+
+class MqttPublishQueue {
+public:
+  struct Stats {
+    uint32_t enqueued;
+    uint32_t published;
+    uint32_t dropped;     // overflow: discarded by policy
+    uint32_t coalesced;   // replaced by a newer value on the same topic
+    uint32_t failed;      // rejected by the client while still connected (e.g. larger than its buffer)
+    uint16_t high_water;  // most arena bytes ever in use
+  };
+
+  MqttPublishQueue() { clear(); }
+
+  void clear() {
+    head = tail = used = 0;
+    count = 0;
+  }
+
+  bool empty() const { return count == 0; }
+  uint16_t size() const { return count; }
+  uint16_t bytes_used() const { return used; }
+  const Stats& stats() const { return st; }
+
+  // From here on push(), drain() and take() can be called from different
+  // tasks: they take a lock, and drain() publishes from a copy so the lock
+  // is never held across a publish.  False if the lock couldn't be created.
+  bool share() {
+    if (!lock) lock = xSemaphoreCreateMutex();
+    return lock != NULL;
+  }
+
+  bool push(const char* topic, const uint8_t* payload, unsigned int length, bool retained,
+            MqttOverflowPolicy policy) {
+    Locked l(lock);
+    size_t topic_len = strlen(topic);
+    size_t need = record_size(topic_len, length);
+    if (need > sizeof(arena)) {
+      st.dropped++;
+      return false;
+    }
+
+    if (policy == MQTT_COALESCE_BY_TOPIC) {
+      Header* old = find_live(topic, topic_len);
+      if (old) {
+        st.coalesced++;
+        if (need <= old->size && (uint8_t*)old - arena != busy) {
+          // Overwrite in place: keeps the topic's position in line, and the
+          // freshest value is what goes out.
+          st.enqueued++;
+          old->payload_len = length;
+          old->flags = retained ? QF_RETAINED : 0;
+          memcpy(record_payload(old), payload, length);
+          return true;
+        }
+        old->flags |= QF_DEAD;
+      }
+    }
+
+    while (!fits(need)) {
+      if (policy == MQTT_DROP_NEWEST) {
+        st.dropped++;
+        return false;
+      }
+      pop_front(true);
+    }
+
+    Header* h = place(need);
+    h->size = need;
+    h->topic_len = topic_len;
+    h->payload_len = length;
+    h->flags = retained ? QF_RETAINED : 0;
+    memcpy(record_topic(h), topic, topic_len + 1);
+    memcpy(record_payload(h), payload, length);
+    count++;
+    st.enqueued++;
+    if (used > st.high_water) st.high_water = used;
+    return true;
+  }
+
+  // Publishes queued messages in order until the queue is empty, the client
+  // refuses one because the connection went away, or budget_ms has elapsed.
+  // A message that fails while the client still reports connected can never
+  // succeed (e.g. it is larger than the client's buffer), so it is dropped
+  // rather than blocking everything behind it.
+  void drain(PubSubClient& client, uint32_t budget_ms) {
+    if (lock) return drain_shared(client, budget_ms);
+    uint32_t start = millis();
+    while (count > 0) {
+      Header* h = front();
+      if (!(h->flags & QF_DEAD)) {
+        if ((uint32_t)(millis() - start) >= budget_ms) return;
+        uint32_t t0 = micros();
+        if (!client.publish(record_topic(h), record_payload(h), h->payload_len, h->flags & QF_RETAINED)) {
+          if (!client.connected()) return;
+          st.failed++;
+        } else {
+          mqtt_metrics.pub_us.record(micros() - t0);
+          st.published++;
+        }
+      }
+      pop_front(false);
+    }
+  }
+
+  // Removes the oldest live message, copying its topic (terminated) and the
+  // payload after it into buf.  One that doesn't fit in size bytes is
+  // dropped.  Returns false once the queue is empty.
+  bool take(uint8_t* buf, size_t size, unsigned int* topic_len, unsigned int* length, bool* retained) {
+    Locked l(lock);
+    for (;;) {
+      while (count > 0 && (front()->flags & QF_DEAD)) pop_front(false);
+      if (count == 0) return false;
+      Header* h = front();
+      if ((size_t)h->topic_len + 1 + h->payload_len <= size) {
+        memcpy(buf, record_topic(h), h->topic_len + 1 + h->payload_len);
+        *topic_len = h->topic_len;
+        *length = h->payload_len;
+        *retained = h->flags & QF_RETAINED;
+        pop_front(false);
+        return true;
+      }
+      pop_front(true);
+    }
+  }
+
+  // Oldest live message, for code that wants to hand it somewhere other than
+  // PubSubClient.  Returns false if the queue is empty.  Not for a shared
+  // queue (the pointers are into it); use take().
+  bool peek(const char** topic, const uint8_t** payload, unsigned int* length, bool* retained) {
+    while (count > 0 && (front()->flags & QF_DEAD)) pop_front(false);
+    if (count == 0) return false;
+    Header* h = front();
+    *topic = record_topic(h);
+    *payload = record_payload(h);
+    *length = h->payload_len;
+    *retained = h->flags & QF_RETAINED;
+    return true;
+  }
+
+  void pop() {
+    if (count > 0) pop_front(false);
+  }
+
+private:
+  enum { QF_RETAINED = 1, QF_DEAD = 2, QF_WRAP = 4 };
+
+  struct Locked {
+    explicit Locked(SemaphoreHandle_t m) : m(m) {
+      if (m) xSemaphoreTake(m, portMAX_DELAY);
+    }
+    ~Locked() {
+      if (m) xSemaphoreGive(m);
+    }
+    SemaphoreHandle_t m;
+  };
+
+  // drain() for a shared queue.  The front message is copied out and left in
+  // place (marked busy, so push() won't rewrite it) while it's published,
+  // then removed, unless push() dropped it meanwhile to make room.
+  void drain_shared(PubSubClient& client, uint32_t budget_ms) {
+    uint32_t start = millis();
+    while ((uint32_t)(millis() - start) < budget_ms) {
+      xSemaphoreTake(lock, portMAX_DELAY);
+      while (count > 0 && (front()->flags & QF_DEAD)) pop_front(false);
+      Header* h = count ? front() : NULL;
+      if (h && h->size > staged_size) {
+        free(staged);
+        staged_size = (staged = (uint8_t*)malloc(h->size)) ? h->size : 0;
+      }
+      if (!h || !staged) {
+        xSemaphoreGive(lock);
+        return;
+      }
+      memcpy(staged, h, h->size);
+      busy = (uint8_t*)h - arena;
+      uint32_t popped = pops;
+      xSemaphoreGive(lock);
+
+      Header* c = (Header*)staged;
+      uint32_t t0 = micros();
+      bool ok = client.publish(record_topic(c), record_payload(c), c->payload_len, c->flags & QF_RETAINED);
+      uint32_t us = micros() - t0;
+
+      Locked l(lock);
+      busy = -1;
+      if (!ok && !client.connected()) return;  // stays in line for the next connection
+      if (ok) mqtt_metrics.pub_us.record(us), st.published++;
+      else st.failed++;
+      if (pops == popped) pop_front(false);
+    }
+  }
+
+  // Records are laid end to end in the arena.  A record never straddles the
+  // end; if it doesn't fit there, a WRAP marker (or, if there isn't even
+  // room for a header, nothing at all) sends the reader back to offset 0.
+  struct Header {
+    uint16_t size;  // whole record including this header, multiple of 4
+    uint16_t topic_len;
+    uint16_t payload_len;
+    uint8_t flags;
+    uint8_t reserved;
+  };
+
+  static size_t record_size(size_t topic_len, size_t payload_len) {
+    return (sizeof(Header) + topic_len + 1 + payload_len + 3) & ~(size_t)3;
+  }
+  static char* record_topic(Header* h) { return (char*)(h + 1); }
+  static uint8_t* record_payload(Header* h) { return (uint8_t*)(h + 1) + h->topic_len + 1; }
+
+  Header* at(uint16_t off) { return (Header*)(arena + off); }
+
+  Header* front() {
+    if (head + sizeof(Header) > sizeof(arena) || (at(head)->flags & QF_WRAP)) {
+      used -= sizeof(arena) - head;
+      head = 0;
+    }
+    return at(head);
+  }
+
+  void pop_front(bool overflow) {
+    Header* h = front();
+    if (overflow && !(h->flags & QF_DEAD)) st.dropped++;
+    pops++;
+    head += h->size;
+    used -= h->size;
+    if (--count == 0) head = tail = used = 0;
+  }
+
+  bool fits(size_t need) const {
+    if (count == 0) return true;
+    if (tail > head) return tail + need <= sizeof(arena) || need <= head;
+    return tail + need <= head;
+  }
+
+  Header* place(size_t need) {
+    if (count > 0 && tail > head && tail + need > sizeof(arena)) {
+      if (tail + sizeof(Header) <= sizeof(arena)) at(tail)->flags = QF_WRAP;
+      used += sizeof(arena) - tail;
+      tail = 0;
+    }
+    Header* h = at(tail);
+    tail += need;
+    used += need;
+    return h;
+  }
+
+  Header* find_live(const char* topic, size_t topic_len) {
+    uint16_t off = head, n = count;
+    while (n > 0) {
+      if (off + sizeof(Header) > sizeof(arena) || (at(off)->flags & QF_WRAP)) off = 0;
+      Header* h = at(off);
+      if (!(h->flags & QF_DEAD) && h->topic_len == topic_len && memcmp(record_topic(h), topic, topic_len) == 0)
+        return h;
+      off += h->size;
+      n--;
+    }
+    return NULL;
+  }
+
+  alignas(4) uint8_t arena[MQTTT_PUBQUEUE_BYTES];
+  uint16_t head, tail, used, count;
+  Stats st = {};
+  // For a shared queue:
+  SemaphoreHandle_t lock = NULL;
+  uint8_t* staged = NULL;  // the message being published, copied out
+  size_t staged_size = 0;
+  int32_t busy = -1;       // its offset in the arena
+  uint32_t pops = 0;
+};
+
+
+// Overflow policy and per-pass drain budget used by the templates' loop().
+// Both can be changed from the sketch at any time (e.g. in setup1()).
+MqttOverflowPolicy publish_queue_policy = MQTT_DROP_OLDEST;
+uint32_t publish_queue_budget_ms = 20;
+
+MqttPublishQueue publish_queue;
+
+// Queues a message for publishing and returns immediately.  Returns false
+// only if the message was refused (too large for the queue, or the queue is
+// full under MQTT_DROP_NEWEST).
+bool mqtt_enqueue(const char* topic, const uint8_t* payload, unsigned int length, bool retained = false) {
+  return publish_queue.push(topic, payload, length, retained, publish_queue_policy);
+}
+
+bool mqtt_enqueue(const char* topic, const char* payload, bool retained = false) {
+  return mqtt_enqueue(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retained);
+}
@@ -0,0 +1,232 @@
+// QoS 1 publishing for the MQTT templates.
+//
+// PubSubClient only publishes at QoS 0: publish() returning true means the
+// message was written to the connection, not that the broker has it.
+// mqtt_qos1 publishes at QoS 1 and keeps each message until the broker's
+// PUBACK for it comes back:
+//
+//   void billed(uint16_t id, uint8_t reason, void* ctx) {
+//     if (reason) ...   // the broker refused it
+//   }
+//
+//   void connectedLoop() {
+//     ...
+//     if (!mqtt_qos1.publish("meters/%s/kwh", reading, false, billed)) {
+//       // window full (or message too big): try again later
+//     }
+//   }
+//
+// Up to qos1_window messages (at most MQTTT_QOS1_WINDOW) can be waiting for
+// their PUBACK at once, so over a slow link several are in flight instead
+// of one per round trip.  publish() copies the message into the window and
+// returns its packet id (0 if it refused it); loop() sends it, on its next
+// pass, if the connection is up.  The
+// completion callback, if given, is called from loop() once the PUBACK is
+// in, with reason 0.  Over MQTT 5 the broker can refuse a message instead
+// (reason 0x80 and up, e.g. 0x87 not authorized); the callback then gets
+// that reason code and the message is dropped, not sent again.
+//
+// Messages still waiting when the connection drops are sent again, in their
+// original order and with the DUP flag, as soon as it's back; messages
+// published while offline are sent then for the first time.  So delivery is
+// at least once: the receiver may see a message twice.  Nothing is kept
+// across a reboot.
+//
+// Each message, topic and MQTT header included, must fit in
+// MQTTT_QOS1_MSG_BYTES.  The slots are allocated on the first publish().
+// Packet ids are taken from 0x8000 up, clear of the ids PubSubClient uses
+// for SUBSCRIBE.  publish() can be called from any task: it only touches the
+// window, under mqttClient's lock (see nettask_MqttT.hpp), and only the
+// networking writes to the connection.
+
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include "wire_MqttT.hpp"
+#include "topics_MqttT.hpp"
+#include "metrics_MqttT.hpp"
+#include "nettask_MqttT.hpp"
+
+#ifndef MQTTT_QOS1_WINDOW
+#define MQTTT_QOS1_WINDOW 16
+#endif
+#ifndef MQTTT_QOS1_MSG_BYTES
+#define MQTTT_QOS1_MSG_BYTES 256
+#endif
+
+// Tunable from the sketch.
+uint8_t qos1_window = 8;
+
+// reason is 0 when the broker has the message, or its MQTT 5 refusal code.
+typedef void (*MqttDelivered)(uint16_t id, uint8_t reason, void* ctx);
+
+class MqttQos1 {
+public:
+  struct Stats {
+    uint32_t published;  // accepted by publish()
+    uint32_t acked;      // PUBACK received
+    uint32_t resent;     // sent again (DUP) after a reconnect
+    uint32_t refused;    // publish() returned 0
+    uint32_t rejected;   // refused by the broker (MQTT 5)
+  };
+
+  MqttQos1(MqttSharedClient& client, MqttWire& wire) : client(client), wire(wire) {}
+
+  // topic goes through mqtt_topics (%s is the MAC).
+  uint16_t publish(const char* topic, const uint8_t* payload, size_t length, bool retained = false,
+                   MqttDelivered done = NULL, void* ctx = NULL) {
+    MqttSharedClient::Held l(client);
+    if (!pool && !(pool = (uint8_t*)malloc(MQTTT_QOS1_WINDOW * MQTTT_QOS1_MSG_BYTES))) return refuse();
+    uint8_t window = qos1_window < MQTTT_QOS1_WINDOW ? qos1_window : MQTTT_QOS1_WINDOW;
+    if (in_flight() >= window) return refuse();
+    int s = free_slot();
+    topic = mqtt_topics.intern(topic);
+    if (!*topic) return refuse();  // mqtt_topics had no room to expand it
+
+    // PUBLISH, QoS 1: fixed header, topic, packet id, payload.
+    size_t topic_len = strlen(topic);
+    size_t remaining = 2 + topic_len + 2 + length;
+    uint8_t* p = pool + s * MQTTT_QOS1_MSG_BYTES;
+    size_t n = 0;
+    p[n++] = 0x32 | (retained ? 1 : 0);
+    do {
+      uint8_t b = remaining & 0x7F;
+      remaining >>= 7;
+      p[n++] = remaining ? b | 0x80 : b;
+    } while (remaining);
+    if (n + 2 + topic_len + 2 + length > MQTTT_QOS1_MSG_BYTES) return refuse();
+    uint16_t id = next_id();
+    p[n++] = topic_len >> 8;
+    p[n++] = topic_len;
+    memcpy(p + n, topic, topic_len);
+    n += topic_len;
+    p[n++] = id >> 8;
+    p[n++] = id;
+    memcpy(p + n, payload, length);
+    n += length;
+
+    slots[s] = Slot{WAITING, false, id, (uint16_t)n, seq++, 0, done, ctx};
+    st.published++;
+    return id;
+  }
+
+  uint16_t publish(const char* topic, const char* payload, bool retained = false, MqttDelivered done = NULL,
+                   void* ctx = NULL) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload), retained, done, ctx);
+  }
+
+  // Called from loop() (the network task's pass) while online: completes
+  // acknowledged messages and sends the rest, new ones and, after a
+  // reconnect, those not acknowledged on the old connection.
+  void service() {
+    uint16_t id;
+    uint8_t reason;
+    while (wire.take_ack(id, reason)) {
+      for (int s = 0; s < MQTTT_QOS1_WINDOW; s++) {
+        Slot& m = slots[s];
+        if (m.state != SENT || m.id != id) continue;
+        if (reason) {
+          st.rejected++;
+        } else {
+          mqtt_metrics.ack_ms.record(millis() - m.sent_at);
+          st.acked++;
+        }
+        m.state = FREE;
+        if (m.done) m.done(id, reason, m.ctx);
+        break;
+      }
+    }
+    send_waiting();
+  }
+
+  size_t in_flight() const {
+    MqttSharedClient::Held l(client);
+    size_t n = 0;
+    for (int s = 0; s < MQTTT_QOS1_WINDOW; s++) n += slots[s].state != FREE;
+    return n;
+  }
+
+  // Written by the networking without a lock: approximate from other tasks.
+  const Stats& stats() const { return st; }
+
+private:
+  enum : uint8_t { FREE, WAITING, SENT };
+
+  struct Slot {
+    uint8_t state;
+    bool dup;
+    uint16_t id, len;
+    uint32_t seq;
+    uint32_t sent_at;
+    MqttDelivered done;
+    void* ctx;
+  };
+
+  int free_slot() const {
+    for (int s = 0; s < MQTTT_QOS1_WINDOW; s++)
+      if (slots[s].state == FREE) return s;
+    return -1;
+  }
+
+  uint16_t next_id() {
+    for (;;) {
+      uint16_t id = last_id = last_id == 0xFFFF ? 0x8000 : last_id + 1;
+      bool used = false;
+      for (int s = 0; s < MQTTT_QOS1_WINDOW; s++)
+        if (slots[s].state != FREE && slots[s].id == id) used = true;
+      if (!used) return id;
+    }
+  }
+
+  // Sends everything not yet sent on this connection, oldest first.
+  void send_waiting() {
+    if (!client.connected()) return;
+    if (wire.sessions() != session) {
+      // A new connection: anything sent on the old one goes again.
+      session = wire.sessions();
+      for (int s = 0; s < MQTTT_QOS1_WINDOW; s++)
+        if (slots[s].state == SENT) slots[s].state = WAITING, slots[s].dup = true;
+    }
+    for (;;) {
+      int next = -1;
+      for (int s = 0; s < MQTTT_QOS1_WINDOW; s++)
+        if (slots[s].state == WAITING && (next < 0 || (int32_t)(slots[s].seq - slots[next].seq) < 0)) next = s;
+      if (next < 0) return;
+      Slot& m = slots[next];
+      uint8_t* p = pool + next * MQTTT_QOS1_MSG_BYTES;
+      if (m.dup) p[0] |= 0x08;
+      uint32_t t0 = micros();
+      size_t n = wire.write(p, m.len);
+      if (n != m.len) {
+        // A partly written packet leaves the stream unusable, and a
+        // DISCONNECT would be read as the rest of it: close the transport
+        // instead, and send the message again (as a DUP) on the next
+        // connection.
+        if (n) {
+          wire.stop();
+          m.dup = true;
+        }
+        return;
+      }
+      mqtt_metrics.pub_us.record(micros() - t0);
+      if (m.dup) st.resent++;
+      m.state = SENT;
+      m.sent_at = millis();
+    }
+  }
+
+  uint16_t refuse() {
+    st.refused++;
+    return 0;
+  }
+
+  MqttSharedClient& client;
+  MqttWire& wire;
+  uint8_t* pool = NULL;
+  Slot slots[MQTTT_QOS1_WINDOW] = {};
+  uint32_t seq = 0;
+  uint16_t last_id = 0x7FFF;
+  uint32_t session = 0;
+  Stats st = {};
+};
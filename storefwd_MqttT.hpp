@@ -0,0 +1,342 @@
+// Store-and-forward spool for the MQTT templates.
+//
+// While the broker can't be reached, anything sitting in the publish queue
+// (see pubqueue_MqttT.hpp) is moved into a ring of fixed-size, CRC-checked
+// slots on flash, so readings survive both the outage and a reboot.  Once
+// connected again, loop() replays the spool oldest-first, one message per
+// storefwd_replay_interval_ms, so a long backlog doesn't swamp the link.
+//
+// Layout of the backing store:
+//   [meta A][meta B][slot 0][slot 1]...[slot N-1]
+// Each message gets the next sequence number, and sequence number s always
+// lives in slot s % N, so writes walk the whole region evenly and recovery
+// after a reboot is a single scan for the highest valid sequence number.
+// The replay position is kept in whichever meta copy is newer; the two are
+// written alternately, and only every MQTTT_STOREFWD_CURSOR_EVERY messages
+// (and when the backlog empties), to keep flash writes down.  The price is
+// that a reboot mid-replay can resend up to that many messages.
+//
+// Messages are replayed with the retained flag cleared: by the time they go
+// out, the live value has usually been published already, and a stale
+// replayed value must not replace it as the topic's retained value.
+//
+// To turn it on, define mqtt_spool_backend() in your sketch and return the
+// storage to use, e.g.
+//   MqttStoreBackend* mqtt_spool_backend() {
+//     static MqttLittleFSStore spool("/mqtt_spool.bin", 65536);
+//     return &spool;
+//   }
+// MqttFileStore does the same with a plain stdio file (the host build uses
+// it; on ESP32 it works with any VFS-mounted path).
+
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <stdio.h>
+#include "pubqueue_MqttT.hpp"
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <LittleFS.h>
+#endif
+
+#ifndef MQTTT_STOREFWD_SLOT
+#define MQTTT_STOREFWD_SLOT 256  // bytes per slot; topic + payload must fit in this less 16
+#endif
+#ifndef MQTTT_STOREFWD_CURSOR_EVERY
+#define MQTTT_STOREFWD_CURSOR_EVERY 16
+#endif
+
+// How many spooled messages to keep at most (0 = as many as the store holds;
+// when full, the oldest are overwritten), and how fast to replay them.
+uint32_t storefwd_retention = 0;
+uint32_t storefwd_replay_interval_ms = 50;
+
+
+// A fixed-size region of storage that can be read and written at any offset.
+class MqttStoreBackend {
+public:
+  virtual ~MqttStoreBackend() {}
+  virtual bool begin() = 0;          // open (creating if necessary) and size to capacity()
+  virtual uint32_t capacity() = 0;
+  virtual bool read(uint32_t offset, void* buf, size_t len) = 0;
+  virtual bool write(uint32_t offset, const void* buf, size_t len) = 0;
+  virtual void sync() {}
+};
+
+// Backend on a plain stdio file.
+class MqttFileStore : public MqttStoreBackend {
+public:
+  MqttFileStore(const char* path, uint32_t bytes) : path(path), bytes(bytes), f(NULL) {}
+  ~MqttFileStore() { if (f) fclose(f); }
+
+  bool begin() override {
+    f = fopen(path, "r+b");
+    if (!f) f = fopen(path, "w+b");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    static const uint8_t zeros[64] = {};
+    while (size >= 0 && (uint32_t)size < bytes) {
+      size_t n = bytes - size < sizeof(zeros) ? bytes - size : sizeof(zeros);
+      if (fwrite(zeros, 1, n, f) != n) return false;
+      size += n;
+    }
+    fflush(f);
+    return true;
+  }
+  uint32_t capacity() override { return bytes; }
+  bool read(uint32_t offset, void* buf, size_t len) override {
+    return f && fseek(f, offset, SEEK_SET) == 0 && fread(buf, 1, len, f) == len;
+  }
+  bool write(uint32_t offset, const void* buf, size_t len) override {
+    return f && fseek(f, offset, SEEK_SET) == 0 && fwrite(buf, 1, len, f) == len;
+  }
+  void sync() override { if (f) fflush(f); }
+
+private:
+  const char* path;
+  uint32_t bytes;
+  FILE* f;
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+// Backend on a file in the LittleFS partition (mounted, and formatted if
+// it has never been, on first use).
+class MqttLittleFSStore : public MqttStoreBackend {
+public:
+  MqttLittleFSStore(const char* path, uint32_t bytes) : path(path), bytes(bytes) {}
+
+  bool begin() override {
+    if (!LittleFS.begin(true)) return false;
+    if (!LittleFS.exists(path)) {
+      File init = LittleFS.open(path, "w");
+      if (!init) return false;
+      static const uint8_t zeros[64] = {};
+      for (uint32_t n = 0; n < bytes; n += sizeof(zeros))
+        init.write(zeros, bytes - n < sizeof(zeros) ? bytes - n : sizeof(zeros));
+      init.close();
+    }
+    f = LittleFS.open(path, "r+");
+    return f && f.size() >= bytes;
+  }
+  uint32_t capacity() override { return bytes; }
+  bool read(uint32_t offset, void* buf, size_t len) override {
+    return f.seek(offset) && f.read((uint8_t*)buf, len) == len;
+  }
+  bool write(uint32_t offset, const void* buf, size_t len) override {
+    return f.seek(offset) && f.write((const uint8_t*)buf, len) == len;
+  }
+  void sync() override { f.flush(); }
+
+private:
+  const char* path;
+  uint32_t bytes;
+  File f;
+};
+#endif
+
+
+// CRC-32 (IEEE), nibble-table version: small, and plenty fast for a few
+// hundred bytes at a time.
+static uint32_t mqttt_crc32(uint32_t crc, const void* data, size_t len) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ table[crc & 15];
+    crc = (crc >> 4) ^ table[crc & 15];
+  }
+  return ~crc;
+}
+
+
+class MqttStoreForward {
+public:
+  struct Stats {
+    uint32_t stored;
+    uint32_t replayed;
+    uint32_t dropped;  // too big for a slot, overwritten before replay, or failed to write
+    uint32_t corrupt;  // slots that failed their CRC at replay time
+  };
+
+  MqttStoreForward() : store(NULL), slots(0), head_seq(1), tail_seq(1), since_cursor(0), meta_gen(0), last_replay(0) {}
+
+  // Opens the backend and recovers the spool.  Returns false (and leaves
+  // store-and-forward off) if the backend can't be used.
+  bool begin(MqttStoreBackend* backend) {
+    store = NULL;
+    if (!backend || !backend->begin()) return false;
+    if (backend->capacity() < 2 * sizeof(Meta) + 2 * MQTTT_STOREFWD_SLOT) return false;
+    store = backend;
+    slots = (store->capacity() - 2 * sizeof(Meta)) / MQTTT_STOREFWD_SLOT;
+
+    uint32_t cursor = 1;
+    Meta m[2];
+    for (int i = 0; i < 2; i++) {
+      if (!store->read(i * sizeof(Meta), &m[i], sizeof(Meta)) || m[i].magic != META_MAGIC ||
+          m[i].crc != mqttt_crc32(0, &m[i], offsetof(Meta, crc)))
+        continue;
+      if (m[i].gen >= meta_gen) meta_gen = m[i].gen, cursor = m[i].tail_seq;
+    }
+
+    uint32_t max_seq = 0;
+    for (uint32_t s = 0; s < slots; s++) {
+      alignas(4) uint8_t buf[MQTTT_STOREFWD_SLOT];
+      Slot* h = (Slot*)buf;
+      if (read_slot(s, buf) && h->seq > max_seq) max_seq = h->seq;
+    }
+    head_seq = max_seq + 1;
+    tail_seq = cursor;
+    if (tail_seq > head_seq) tail_seq = head_seq;  // meta from a wiped spool
+    trim();
+    return true;
+  }
+
+  bool active() const { return store != NULL; }
+  uint32_t backlog() const { return head_seq - tail_seq; }
+  const Stats& stats() const { return st; }
+
+  bool put(const char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    if (!store) return false;
+    size_t topic_len = strlen(topic);
+    if (sizeof(Slot) + topic_len + length > MQTTT_STOREFWD_SLOT) {
+      st.dropped++;
+      return false;
+    }
+    alignas(4) uint8_t buf[MQTTT_STOREFWD_SLOT];
+    Slot* h = (Slot*)buf;
+    h->seq = head_seq;
+    h->topic_len = topic_len;
+    h->payload_len = length;
+    h->flags = retained ? SF_RETAINED : 0;
+    memset(h->reserved, 0, sizeof(h->reserved));
+    h->crc = 0;
+    memcpy(buf + sizeof(Slot), topic, topic_len);
+    memcpy(buf + sizeof(Slot) + topic_len, payload, length);
+    size_t len = sizeof(Slot) + topic_len + length;
+    h->crc = mqttt_crc32(0, buf, len);
+    if (!store->write(slot_offset(head_seq % slots), buf, len)) {
+      st.dropped++;
+      return false;
+    }
+    store->sync();
+    head_seq++;
+    st.stored++;
+    trim();
+    return true;
+  }
+
+  // Moves everything in the publish queue into the spool.
+  void spill(MqttPublishQueue& q) {
+    if (!store) return;
+    // Copied out, as the queue may be shared with another task.
+    uint8_t buf[MQTTT_STOREFWD_SLOT];
+    unsigned int topic_len, length;
+    bool retained;
+    while (q.take(buf, sizeof(buf), &topic_len, &length, &retained))
+      put((const char*)buf, buf + topic_len + 1, length, retained);
+  }
+
+  // Publishes the oldest spooled message, if there is one and interval_ms
+  // has passed since the last.  Call while connected.
+  void replay(PubSubClient& client, uint32_t interval_ms) {
+    if (!store || tail_seq == head_seq) return;
+    if ((uint32_t)(millis() - last_replay) < interval_ms) return;
+    last_replay = millis();
+
+    alignas(4) uint8_t buf[MQTTT_STOREFWD_SLOT];
+    Slot* h = (Slot*)buf;
+    if (!read_slot(tail_seq % slots, buf) || h->seq != tail_seq) {
+      st.corrupt++;
+    } else {
+      // publish() wants a terminated topic; it's followed directly by the
+      // payload, so copy it out.
+      char topic[MQTTT_STOREFWD_SLOT];
+      memcpy(topic, buf + sizeof(Slot), h->topic_len);
+      topic[h->topic_len] = 0;
+      uint32_t t0 = micros();
+      if (!client.publish(topic, buf + sizeof(Slot) + h->topic_len, h->payload_len, false)) {
+        if (!client.connected()) return;  // try again after reconnecting
+        st.dropped++;
+      } else {
+        mqtt_metrics.pub_us.record(micros() - t0);
+        st.replayed++;
+      }
+    }
+    tail_seq++;
+    if (++since_cursor >= MQTTT_STOREFWD_CURSOR_EVERY || tail_seq == head_seq) save_cursor();
+  }
+
+private:
+  enum { META_MAGIC = 0x4D535046, SF_RETAINED = 1 };
+
+  struct Meta {
+    uint32_t magic;
+    uint32_t gen;
+    uint32_t tail_seq;
+    uint32_t crc;
+  };
+
+  struct Slot {
+    uint32_t seq;  // 0 = empty
+    uint16_t topic_len;
+    uint16_t payload_len;
+    uint8_t flags;
+    uint8_t reserved[3];
+    uint32_t crc;  // over the slot header (with crc = 0), topic and payload
+  };
+
+  uint32_t slot_offset(uint32_t slot) const { return 2 * sizeof(Meta) + slot * MQTTT_STOREFWD_SLOT; }
+
+  // Reads a slot into buf (MQTTT_STOREFWD_SLOT bytes), returns true if it
+  // holds a message that passes its CRC.
+  bool read_slot(uint32_t slot, uint8_t* buf) {
+    Slot* h = (Slot*)buf;
+    if (!store->read(slot_offset(slot), buf, sizeof(Slot)) || h->seq == 0) return false;
+    size_t len = sizeof(Slot) + h->topic_len + h->payload_len;
+    if (len > MQTTT_STOREFWD_SLOT || !store->read(slot_offset(slot) + sizeof(Slot), buf + sizeof(Slot), len - sizeof(Slot)))
+      return false;
+    uint32_t crc = h->crc;
+    h->crc = 0;
+    bool ok = crc == mqttt_crc32(0, buf, len);
+    h->crc = crc;
+    return ok;
+  }
+
+  // Enforces the retention cap (and the ring size) by skipping the oldest.
+  void trim() {
+    uint32_t keep = slots;
+    if (storefwd_retention && storefwd_retention < keep) keep = storefwd_retention;
+    if (head_seq - tail_seq > keep) {
+      st.dropped += head_seq - tail_seq - keep;
+      tail_seq = head_seq - keep;
+    }
+  }
+
+  void save_cursor() {
+    since_cursor = 0;
+    Meta m;
+    m.magic = META_MAGIC;
+    m.gen = ++meta_gen;
+    m.tail_seq = tail_seq;
+    m.crc = mqttt_crc32(0, &m, offsetof(Meta, crc));
+    store->write((m.gen & 1) * sizeof(Meta), &m, sizeof(m));
+    store->sync();
+  }
+
+  MqttStoreBackend* store;
+  uint32_t slots;
+  uint32_t head_seq;  // sequence number the next message gets
+  uint32_t tail_seq;  // oldest message not yet replayed
+  uint32_t since_cursor;
+  uint32_t meta_gen;
+  uint32_t last_replay;
+  Stats st = {};
+};
+
+MqttStoreForward storefwd;
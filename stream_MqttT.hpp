@@ -0,0 +1,101 @@
+// Streaming publish for payloads bigger than PubSubClient's buffer.
+//
+// mqttClient.publish() needs the whole message in PubSubClient's buffer,
+// so a large payload means a large buffer, held for good.  These send the
+// payload straight to the connection as it's produced, through
+// beginPublish()/write()/endPublish(); the payload is never put together
+// in RAM.  MQTT needs the length up front, so it has to be known.
+//
+// From several buffers as they are (scatter-gather):
+//
+//   MqttChunk parts[] = {{header, sizeof(header)}, {samples, n * sizeof(int16_t)}};
+//   mqtt_publish_chunks(mqttClient, topic, parts, 2);
+//
+// From a generator that fills a small buffer (MQTTT_STREAM_CHUNK bytes, on
+// the stack) each time it's called, and returns how much it put there:
+//
+//   size_t pos = 0;
+//   mqtt_publish_stream(mqttClient, topic, capture_len, [&](uint8_t* buf, size_t room) {
+//     size_t n = read_capture(pos, buf, room);
+//     pos += n;
+//     return n;
+//   });
+//
+// Or from a Stream, e.g. a file:
+//
+//   File f = LittleFS.open("/thumb.jpg");
+//   mqtt_publish_stream(mqttClient, topic, f, f.size());
+//
+// If the payload comes up short, or the connection fails part way, the
+// message can't be finished, so the transport is closed (the broker
+// discards the partial message) and false is returned; the connection state
+// machine reconnects as usual.  Don't call loop() or publish anything else
+// from inside a generator.
+
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include "metrics_MqttT.hpp"
+
+#ifndef MQTTT_STREAM_CHUNK
+#define MQTTT_STREAM_CHUNK 256
+#endif
+
+struct MqttChunk {
+  const void* data;
+  size_t len;
+};
+
+// From the core.
+void mqtt_abort_publish();
+
+// Gives up on a message that was started but can't be finished.  Not with
+// client.disconnect(): its DISCONNECT would go out as part of the open
+// PUBLISH, and if that was two bytes short, the broker would take it as
+// the end of the message.
+inline bool mqtt_stream_abort(PubSubClient& client) {
+  mqtt_abort_publish();
+  return false;
+}
+
+inline bool mqtt_publish_chunks(PubSubClient& client, const char* topic, const MqttChunk* chunks, size_t count,
+                                bool retained = false) {
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) total += chunks[i].len;
+  uint32_t t0 = micros();
+  if (!client.beginPublish(topic, total, retained)) return false;
+  for (size_t i = 0; i < count; i++)
+    if (chunks[i].len && client.write((const uint8_t*)chunks[i].data, chunks[i].len) != chunks[i].len)
+      return mqtt_stream_abort(client);
+  if (!client.endPublish()) return false;
+  mqtt_metrics.pub_us.record(micros() - t0);
+  return true;
+}
+
+// gen(uint8_t* buf, size_t room) returns the number of bytes it wrote to buf
+// (at most room); 0 before length bytes have been produced is an error.
+template <class Generator>
+bool mqtt_publish_stream(PubSubClient& client, const char* topic, size_t length, Generator gen,
+                         bool retained = false) {
+  uint32_t t0 = micros();
+  if (!client.beginPublish(topic, length, retained)) return false;
+  uint8_t buf[MQTTT_STREAM_CHUNK];
+  for (size_t left = length; left > 0;) {
+    size_t n = gen(buf, left < sizeof(buf) ? left : sizeof(buf));
+    if (n == 0 || n > left) return mqtt_stream_abort(client);
+    if (client.write(buf, n) != n) return mqtt_stream_abort(client);
+    left -= n;
+  }
+  if (!client.endPublish()) return false;
+  mqtt_metrics.pub_us.record(micros() - t0);
+  return true;
+}
+
+inline bool mqtt_publish_stream(PubSubClient& client, const char* topic, Stream& src, size_t length,
+                                bool retained = false) {
+  return mqtt_publish_stream(client, topic, length, [&](uint8_t* buf, size_t room) -> size_t {
+    // readBytes() waits (up to the Stream's timeout) for data that's slow to come.
+    return src.readBytes(buf, room);
+  }, retained);
+}
@@ -0,0 +1,269 @@
+// Subscriptions with a handler per topic filter.
+//
+// Instead of one callback full of strcmp()s, register each filter with the
+// function that handles it, e.g. at global scope in the sketch:
+//
+//   void set_led(char* topic, byte* payload, unsigned int length) { ... }
+//   void any_config(char* topic, byte* payload, unsigned int length) { ... }
+//
+//   bool led_sub = mqtt_subscriptions.on("cmd/%s/led", set_led);
+//   bool cfg_sub = mqtt_subscriptions.on("config/+/%s/#", any_config, 1);
+//
+// Filters go through mqtt_topics (%s is the MAC) and may use the MQTT
+// wildcards + (one level) and # (the rest, at the end).  Every filter is
+// subscribed to when the connection comes up, along with
+// watchdog_subscribe_topic, so nothing needs redoing after a reconnect;
+// on() while connected has the filter subscribed to on the connection's
+// next pass.  A filter registered more than once is subscribed to at the
+// highest QoS any of them asked for.
+//
+// The filters are built into a trie, one node per level, so an incoming
+// topic is matched a level at a time instead of against every filter.  Each
+// handler whose filter matches gets the message, in the order they were
+// registered.  Messages no filter matches go to the core's default handling
+// (printed to Serial).  As in MQTT, a topic starting with $ isn't matched by
+// a filter starting with a wildcard.
+//
+// Handlers run on the networking thread, inside mqttClient.loop(), unless
+// inbound_mode hands them to another task (inbound_MqttT.hpp); keep them
+// short.  on() can be called from any task, handlers included: the trie is
+// rebuilt under a mutex that dispatch() holds while matching, but not while
+// the handlers run, and on() never uses mqttClient itself.  The core creates it with share() at the start of
+// setup(); global initializers run before that, on one task.
+// MQTTT_SUBS_MAX handlers and MQTTT_SUB_NODES trie nodes fit; on() returns
+// false past that.
+
+#pragma once
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "topics_MqttT.hpp"
+
+#ifndef MQTTT_SUBS_MAX
+#define MQTTT_SUBS_MAX 16
+#endif
+#ifndef MQTTT_SUB_NODES
+#define MQTTT_SUB_NODES 48
+#endif
+
+typedef void (*MqttHandler)(char* topic, uint8_t* payload, unsigned int length);
+
+class MqttSubscriptions {
+public:
+  explicit MqttSubscriptions(PubSubClient& client) : client(client) {}
+
+  // Called by the core before any other task starts.
+  bool share() {
+    if (!lock) lock = xSemaphoreCreateMutex();
+    return lock != NULL;
+  }
+
+  bool on(const char* filter, MqttHandler handler, uint8_t qos = 0) {
+    MqttTopic h = mqtt_topics.add(filter);
+    if (h == MQTT_NO_TOPIC || !handler) return false;
+    take();
+    int before = max_qos(h);  // -1 if the filter is new
+    bool ok = n_subs < MQTTT_SUBS_MAX;
+    if (ok) {
+      // Subscribing again to a filter replaces its QoS, so a higher one
+      // needs sending too.
+      subs[n_subs++] = {h, handler, qos, qos <= before};
+      if (!build()) {
+        n_subs--;
+        build();
+        ok = false;
+      } else if (qos > before) added = true;
+    }
+    give();
+    return ok;
+  }
+
+  // Subscribes to every filter; called by the connection state machine.
+  bool resubscribe() {
+    MqttTopic filters[MQTTT_SUBS_MAX];
+    uint8_t qos[MQTTT_SUBS_MAX], n = 0;
+    take();
+    if (built_expanded != mqtt_topics.expanded()) build();
+    for (uint8_t i = 0; i < n_subs; i++) {
+      bool first = true;
+      for (uint8_t j = 0; j < i; j++)
+        if (subs[j].filter == subs[i].filter) first = false;
+      if (first) filters[n] = subs[i].filter, qos[n++] = max_qos(subs[i].filter);
+      subs[i].sent = true;
+    }
+    added = false;  // whatever on() adds from here on sets it again
+    give();
+    return send(filters, qos, n);
+  }
+
+  // Subscribes to the filters on() added since; called by the connection
+  // state machine on every pass while online.
+  bool send_added() {
+    if (!added) return true;
+    MqttTopic filters[MQTTT_SUBS_MAX];
+    uint8_t qos[MQTTT_SUBS_MAX], n = 0;
+    take();
+    for (uint8_t i = 0; i < n_subs; i++) {
+      if (subs[i].sent) continue;
+      filters[n] = subs[i].filter, qos[n++] = max_qos(subs[i].filter);
+      for (uint8_t j = i; j < n_subs; j++)
+        if (subs[j].filter == subs[i].filter) subs[j].sent = true;
+    }
+    added = false;
+    give();
+    // One that fails has the connection dropped, and every filter is
+    // subscribed to again when it comes back.
+    return send(filters, qos, n);
+  }
+
+  // Whether a filter has been added since the last resubscribe() without
+  // being subscribed to (so a session the broker kept doesn't have it).
+  bool unsent() const { return added; }
+
+  // Hands the message to every matching handler.  Returns false if there
+  // was none.
+  bool dispatch(char* topic, uint8_t* payload, unsigned int length) {
+    MqttHandler calls[MQTTT_SUBS_MAX];
+    uint8_t n = 0;
+    take();
+    if (n_subs) {
+      bool hit[MQTTT_SUBS_MAX] = {};
+      match(0, topic, topic[0] == '$', hit);
+      // In registration order, whichever branch of the trie they matched on.
+      for (uint8_t i = 0; i < n_subs; i++)
+        if (hit[i]) calls[n++] = subs[i].handler;
+    }
+    give();
+    // Outside the lock, so a handler can call on().
+    for (uint8_t i = 0; i < n; i++) calls[i](topic, payload, length);
+    return n > 0;
+  }
+
+  size_t count() const { return n_subs; }
+
+private:
+  enum : uint8_t { NONE = 0xFF };
+
+  struct Sub {
+    MqttTopic filter;
+    MqttHandler handler;
+    uint8_t qos;
+    bool sent;  // subscribed to at (at least) qos
+  };
+
+  struct Node {
+    const char* level;  // in mqtt_topics' arena; not terminated
+    uint8_t len;
+    uint8_t child, sibling;  // literal children
+    uint8_t plus, hash;      // the + and # children
+    uint8_t first_sub;       // filters ending here: a chain through next_sub
+  };
+
+  // Not under the lock: under MQTTT_NET_TASK the network task holds
+  // mqttClient's lock while it dispatches.
+  bool send(const MqttTopic* filters, const uint8_t* qos, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++)
+      if (!client.subscribe(mqtt_topics[filters[i]], qos[i])) return false;
+    return true;
+  }
+
+  void take() {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+  }
+  void give() {
+    if (lock) xSemaphoreGive(lock);
+  }
+
+  // The highest QoS any handler registered the filter with; -1 if none did.
+  int max_qos(MqttTopic filter) const {
+    int q = -1;
+    for (uint8_t i = 0; i < n_subs; i++)
+      if (subs[i].filter == filter && subs[i].qos > q) q = subs[i].qos;
+    return q;
+  }
+
+  // Rebuilds the trie from the (expanded) filters.  False if it didn't fit.
+  bool build() {
+    built_expanded = mqtt_topics.expanded();
+    n_nodes = 1;
+    nodes[0] = Node{"", 0, NONE, NONE, NONE, NONE, NONE};
+    bool ok = true;
+    for (uint8_t i = 0; i < n_subs; i++) {
+      uint8_t at = 0;
+      const char* f = mqtt_topics[subs[i].filter];
+      for (;;) {
+        const char* end = strchr(f, '/');
+        size_t len = end ? end - f : strlen(f);
+        at = child(at, f, len);
+        if (at == NONE) break;
+        if (!end) break;
+        f = end + 1;
+      }
+      if (at == NONE) {
+        ok = false;
+        continue;
+      }
+      next_sub[i] = NONE;
+      uint8_t* link = &nodes[at].first_sub;
+      while (*link != NONE) link = &next_sub[*link];
+      *link = i;
+    }
+    return ok;
+  }
+
+  // Finds or adds the child of parent for one level of a filter.
+  uint8_t child(uint8_t parent, const char* level, size_t len) {
+    Node& p = nodes[parent];
+    uint8_t* link = &p.child;
+    if (len == 1 && level[0] == '+') link = &p.plus;
+    else if (len == 1 && level[0] == '#') link = &p.hash;
+    else {
+      for (uint8_t c = p.child; c != NONE; c = nodes[c].sibling)
+        if (nodes[c].len == len && memcmp(nodes[c].level, level, len) == 0) return c;
+    }
+    if (link != &p.child && *link != NONE) return *link;
+    if (n_nodes == MQTTT_SUB_NODES || len > 255) return NONE;
+    uint8_t c = n_nodes++;
+    nodes[c] = Node{level, (uint8_t)len, NONE, NONE, NONE, NONE, NONE};
+    if (link == &p.child) nodes[c].sibling = p.child;  // new literals go at the front
+    *link = c;
+    return c;
+  }
+
+  // topic is the rest of the topic from the current level on, or NULL once
+  // it's all been matched.
+  void match(uint8_t at, const char* topic, bool dollar, bool* hit) {
+    const Node& node = nodes[at];
+    // "a/#" matches "a" as well as everything under it.
+    if (node.hash != NONE && !dollar) add_subs(node.hash, hit);
+    if (!topic) {
+      add_subs(at, hit);
+      return;
+    }
+    const char* end = strchr(topic, '/');
+    size_t len = end ? end - topic : strlen(topic);
+    const char* rest = end ? end + 1 : NULL;
+    for (uint8_t c = node.child; c != NONE; c = nodes[c].sibling)
+      if (nodes[c].len == len && memcmp(nodes[c].level, topic, len) == 0) {
+        match(c, rest, false, hit);
+        break;
+      }
+    if (node.plus != NONE && !dollar) match(node.plus, rest, false, hit);
+  }
+
+  void add_subs(uint8_t at, bool* hit) {
+    for (uint8_t s = nodes[at].first_sub; s != NONE; s = next_sub[s]) hit[s] = true;
+  }
+
+  PubSubClient& client;
+  Sub subs[MQTTT_SUBS_MAX];
+  uint8_t next_sub[MQTTT_SUBS_MAX];
+  uint8_t n_subs = 0;
+  Node nodes[MQTTT_SUB_NODES];
+  uint8_t n_nodes = 0;
+  bool built_expanded = false;
+  std::atomic<bool> added{false};
+  SemaphoreHandle_t lock = NULL;
+};
@@ -0,0 +1,83 @@
+// Where the loop1() task runs, and how big its stack is.
+//
+// With loop1() defined, setup() starts it (after setup1()) in the "Arduino
+// Task".  These can be defined before including the board header:
+//
+//   #define MQTTT_LOOP1_CORE 0         // pin to core 0 or 1; -1 for either
+//   #define MQTTT_LOOP1_PRIORITY 2     // default 1, the same as loop()
+//   #define MQTTT_LOOP1_STACK 6144     // bytes; default 10000
+//   #include "AtomS3_Mqtt.hpp"
+//
+// By default the task is pinned to the core the networking isn't running on
+// (loop()'s, or the network task's with MQTTT_NET_TASK), so UI work in
+// loop1() and the networking don't take turns on one core (on single-core
+// chips it runs where it can).
+//
+// To size the stack, build once with
+//
+//   #define MQTTT_LOOP1_CALIBRATE
+//
+// and exercise everything loop1() does.  The task then gets a generous
+// stack (MQTTT_LOOP1_STACK defaults to 16384), and loop() prints to Serial
+// whenever the most of it used so far goes up:
+//
+//   loop1() stack: 3412 of 16384 bytes used; suggest #define MQTTT_LOOP1_STACK 5376
+//
+// The suggestion is the most used plus a quarter and 1 KB, so it's only as
+// good as the paths loop1() took while calibrating.  The unused stack also
+// goes out in the self-telemetry as stack_free.
+
+#pragma once
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifndef MQTTT_LOOP1_STACK
+#ifdef MQTTT_LOOP1_CALIBRATE
+#define MQTTT_LOOP1_STACK 16384
+#else
+#define MQTTT_LOOP1_STACK 10000
+#endif
+#endif
+#ifndef MQTTT_LOOP1_PRIORITY
+#define MQTTT_LOOP1_PRIORITY 1
+#endif
+
+// The core for the loop1() task: MQTTT_LOOP1_CORE, or the other one from
+// the networking's: the network task's if it's pinned elsewhere, otherwise
+// the caller's (setup() runs where loop() will).
+inline BaseType_t mqtt_loop1_core() {
+#if defined(MQTTT_LOOP1_CORE)
+  return MQTTT_LOOP1_CORE < 0 ? tskNO_AFFINITY : MQTTT_LOOP1_CORE;
+#elif defined(MQTTT_NET_TASK) && defined(MQTTT_NET_CORE)
+  return portNUM_PROCESSORS > 1 && MQTTT_NET_CORE >= 0 ? 1 - MQTTT_NET_CORE : tskNO_AFFINITY;
+#else
+  return portNUM_PROCESSORS > 1 ? 1 - xPortGetCoreID() : tskNO_AFFINITY;
+#endif
+}
+
+// Starts the "Arduino Task" running fn.
+inline bool mqtt_start_loop1(TaskFunction_t fn, TaskHandle_t* handle) {
+  if (xTaskCreatePinnedToCore(fn, "Arduino Task", MQTTT_LOOP1_STACK, NULL, MQTTT_LOOP1_PRIORITY, handle,
+                              mqtt_loop1_core()) == pdPASS)
+    return true;
+  Serial.printf("loop1(): couldn't start its task (%u byte stack)\n", (unsigned)MQTTT_LOOP1_STACK);
+  return false;
+}
+
+#ifdef MQTTT_LOOP1_CALIBRATE
+// Called from loop(): reports each new high-water mark of the loop1() task.
+inline void mqtt_loop1_calibrate(TaskHandle_t task) {
+  static uint32_t most_used, last_check;
+  if (!task || millis() - last_check < 1000) return;
+  last_check = millis();
+  // The ESP32's FreeRTOS counts stack in bytes.
+  uint32_t used = MQTTT_LOOP1_STACK - uxTaskGetStackHighWaterMark(task);
+  if (used <= most_used) return;
+  most_used = used;
+  uint32_t suggest = (used + used / 4 + 1024 + 255) & ~255u;
+  Serial.printf("loop1() stack: %u of %u bytes used; suggest #define MQTTT_LOOP1_STACK %u\n", (unsigned)used,
+                (unsigned)MQTTT_LOOP1_STACK, (unsigned)suggest);
+}
+#endif
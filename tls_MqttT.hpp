@@ -0,0 +1,432 @@
+// TLS client for the MQTT templates, with session resumption.
+//
+// Does the job WiFiClientSecure used to do for espClient, with two
+// differences:
+//
+//  - The TCP connect (open()) and the TLS handshake (handshake(), called
+//    until it finishes) are separate steps, and the handshake is advanced
+//    only as far as the data that has arrived allows, so the connection
+//    state machine can poll it without sitting in it.
+//
+//  - The session from the last successful handshake is kept, in RAM and in
+//    RTC memory so that it survives esp_restart() and watchdog resets (not
+//    power loss), and is offered on the next connect to the same server.  If
+//    the broker accepts it (by session ID or session ticket), the certificate
+//    exchange and key agreement are skipped; if not, it's an ordinary full
+//    handshake.  espClient.stats() has the counts and times of both kinds.
+//
+// A session that includes the broker's certificate can be bigger than
+// MQTTT_TLS_SESSION_BYTES, in which case it is only kept in RAM.
+//
+// The trusted CAs live, already parsed, in mqtt_ca_store
+// (certstore_MqttT.hpp).  The mbedTLS configuration and SSL context are set
+// up on the first connect and reset, not rebuilt, for each one after that,
+// so a reconnect doesn't parse certificates or reallocate TLS buffers.
+//
+// Built on ESP32 only.  Elsewhere, or with MQTTT_USE_WIFICLIENTSECURE
+// defined, MqttSecureClient is plain WiFiClientSecure.
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+
+#if defined(ARDUINO_ARCH_ESP32) && !defined(MQTTT_USE_WIFICLIENTSECURE)
+
+#include <Client.h>
+#include <WiFi.h>
+#include <esp_attr.h>
+#include <lwip/sockets.h>
+#include <mbedtls/version.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/x509_crt.h>
+#include "storefwd_MqttT.hpp"  // mqttt_crc32()
+#include "certstore_MqttT.hpp"
+
+#ifndef MQTTT_TLS_SESSION_BYTES
+#define MQTTT_TLS_SESSION_BYTES 2048
+#endif
+
+// mbedTLS 3 made the session fields private; we only read them.
+#if MBEDTLS_VERSION_MAJOR >= 3
+#define MQTTT_TLS_FIELD(m) MBEDTLS_PRIVATE(m)
+#else
+#define MQTTT_TLS_FIELD(m) m
+#endif
+
+struct MqttTlsSavedSession {
+  uint32_t magic;
+  uint32_t server;  // hash of host and port it belongs to
+  uint32_t len;
+  uint32_t crc;
+  uint8_t data[MQTTT_TLS_SESSION_BYTES];
+};
+RTC_NOINIT_ATTR MqttTlsSavedSession mqtt_tls_rtc_session;
+
+class MqttTlsClient : public Client {
+public:
+  struct Stats {
+    uint32_t full_handshakes;
+    uint32_t resumed_handshakes;
+    uint32_t failed_handshakes;
+    uint32_t last_full_ms;     // how long the most recent one of each kind took
+    uint32_t last_resumed_ms;
+  };
+
+  MqttTlsClient() { mbedtls_ssl_session_init(&session); }
+  ~MqttTlsClient() {
+    stop();
+    release_ssl();
+    mbedtls_ssl_session_free(&session);
+  }
+
+  // Parses pem into mqtt_ca_store (once; setting the same string again is a
+  // no-op).
+  void setCACert(const char* pem) {
+    if (pem == ca_pem) return;
+    ca_pem = pem;
+    if (!mqtt_ca_store.add_pem(pem)) Serial.println("TLS: couldn't parse CA certificate");
+  }
+  void setInsecure() { insecure = true; }
+  void setHandshakeTimeout(unsigned long seconds) { handshake_timeout_ms = seconds * 1000; }
+
+  const Stats& stats() const { return st; }
+  bool resumed() const { return was_resumed; }  // was the current connection's handshake resumed?
+
+  // Drops the saved session, so the next handshake is a full one.
+  void forget_session() {
+    have_session = false;
+    mqtt_tls_rtc_session.magic = 0;
+  }
+
+  // TCP connect to ip, bounded by timeout_ms.  host is the name the broker's
+  // certificate has to match (and is sent as SNI).  On success, call
+  // handshake() until it stops returning 0.
+  bool open(const char* host, IPAddress ip, uint16_t port, uint32_t timeout_ms) {
+    stop();
+    if (!init_once()) return false;
+    strlcpy(server, host, sizeof(server));
+    server_id = server_hash(host, port);
+
+    fd = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) return false;
+    lwip_fcntl(fd, F_SETFL, lwip_fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = (uint32_t)ip;
+    if (lwip_connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) {
+      if (errno != EINPROGRESS || !wait_fd(true, timeout_ms)) {
+        stop();
+        return false;
+      }
+      int err = 0;
+      socklen_t len = sizeof(err);
+      lwip_getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err) {
+        stop();
+        return false;
+      }
+    }
+    int one = 1;
+    lwip_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (!setup_ssl()) {
+      stop();
+      return false;
+    }
+    state = HANDSHAKING;
+    hs_start = millis();
+    return true;
+  }
+
+  // Advances the handshake with whatever has arrived.  Returns 0 while it's
+  // still going, 1 once connected, -1 if it failed (or ran past the
+  // handshake timeout).
+  int handshake() {
+    if (state == CONNECTED) return 1;
+    if (state != HANDSHAKING) return -1;
+    int rc = mbedtls_ssl_handshake(&ssl);
+    if (rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      if ((uint32_t)(millis() - hs_start) < handshake_timeout_ms) return 0;
+      rc = MBEDTLS_ERR_SSL_TIMEOUT;
+    }
+    if (rc != 0) {
+      st.failed_handshakes++;
+      Serial.printf("TLS handshake failed: -0x%04x\n", -rc);
+      // A session the broker chokes on isn't worth offering again.
+      if (offered) forget_session();
+      stop();
+      return -1;
+    }
+
+    uint32_t took = millis() - hs_start;
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_session_init(&session);
+    have_session = mbedtls_ssl_get_session(&ssl, &session) == 0;
+    // A resumed session carries on with the master secret we offered; a
+    // full handshake always makes a new one.
+    was_resumed = offered && have_session &&
+                  memcmp(session.MQTTT_TLS_FIELD(master), offered_master, sizeof(offered_master)) == 0;
+    if (was_resumed) st.resumed_handshakes++, st.last_resumed_ms = took;
+    else st.full_handshakes++, st.last_full_ms = took;
+    Serial.printf("TLS handshake (%s) %u ms\n", was_resumed ? "resumed" : "full", (unsigned)took);
+    if (have_session) save_rtc();
+
+    state = CONNECTED;
+    return 1;
+  }
+
+  // Blocking connects, for anything that uses this like any other Client.
+  int connect(IPAddress ip, uint16_t port) { return connect(ip, port, (int32_t)handshake_timeout_ms); }
+  int connect(const char* host, uint16_t port) { return connect(host, port, (int32_t)handshake_timeout_ms); }
+  int connect(IPAddress ip, uint16_t port, int32_t timeout) {
+    return open(ip.toString().c_str(), ip, port, timeout) && finish_handshake();
+  }
+  int connect(const char* host, uint16_t port, int32_t timeout) {
+    IPAddress ip;
+    if (!ip.fromString(host) && !WiFi.hostByName(host, ip)) return 0;
+    return open(host, ip, port, timeout) && finish_handshake();
+  }
+
+  size_t write(uint8_t b) { return write(&b, 1); }
+
+  size_t write(const uint8_t* buf, size_t size) {
+    size_t done = 0;
+    uint32_t start = millis();
+    while (state == CONNECTED && done < size) {
+      int rc = mbedtls_ssl_write(&ssl, buf + done, size - done);
+      if (rc > 0) {
+        done += rc;
+      } else if (rc == MBEDTLS_ERR_SSL_WANT_WRITE || rc == MBEDTLS_ERR_SSL_WANT_READ) {
+        uint32_t spent = millis() - start;
+        if (spent >= write_timeout_ms || !wait_fd(rc == MBEDTLS_ERR_SSL_WANT_WRITE, write_timeout_ms - spent)) {
+          state = BROKEN;
+        }
+      } else state = BROKEN;
+    }
+    return done;
+  }
+
+  int available() {
+    if (rx_pos < rx_len) return rx_len - rx_pos;
+    if (state != CONNECTED) return 0;
+    int rc = mbedtls_ssl_read(&ssl, rx, sizeof(rx));
+    if (rc > 0) {
+      rx_pos = 0;
+      rx_len = rc;
+      return rc;
+    }
+    if (rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE) return 0;
+#ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+    if (rc == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) return 0;
+#endif
+    state = BROKEN;  // closed by the peer, or an error
+    return 0;
+  }
+
+  int read() { return available() ? rx[rx_pos++] : -1; }
+
+  int read(uint8_t* buf, size_t size) {
+    int n = available();
+    if (n <= 0) return -1;
+    if ((size_t)n > size) n = size;
+    memcpy(buf, rx + rx_pos, n);
+    rx_pos += n;
+    return n;
+  }
+
+  int peek() { return available() ? rx[rx_pos] : -1; }
+  void flush() {}
+
+  void stop() {
+    if (state == CONNECTED) mbedtls_ssl_close_notify(&ssl);
+    if (fd >= 0) lwip_close(fd);
+    fd = -1;
+    state = IDLE;
+    rx_pos = rx_len = 0;
+  }
+
+  uint8_t connected() {
+    if (state == CONNECTED) available();  // notices a close from the other end
+    return state == CONNECTED || rx_pos < rx_len;
+  }
+
+  operator bool() { return connected(); }
+
+private:
+  enum { IDLE, HANDSHAKING, CONNECTED, BROKEN };
+  enum { SESSION_MAGIC = 0x4D54534Cu };
+
+  bool init_once() {
+    if (rng_ready) return true;
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    if (mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)"MqttT", 5) != 0)
+      return false;
+    load_rtc();
+    rng_ready = true;
+    return true;
+  }
+
+  bool setup_ssl() {
+    if (!insecure && mqtt_ca_store.count() == 0) {
+      Serial.println("TLS: no CA certificate set");
+      return false;
+    }
+    // Rebuilt only if the CAs (or setInsecure()) changed since last time.
+    if (ssl_ready && (ssl_gen != mqtt_ca_store.generation() || ssl_insecure != insecure)) release_ssl();
+    if (!ssl_ready) {
+      mbedtls_ssl_init(&ssl);
+      mbedtls_ssl_config_init(&conf);
+      ssl_ready = true;
+      ssl_gen = mqtt_ca_store.generation();
+      ssl_insecure = insecure;
+      if (mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT) != 0) return false;
+      if (insecure) {
+        mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+      } else {
+        mqtt_ca_store.configure(&conf);
+        mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+      }
+      mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+      mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+      if (mbedtls_ssl_setup(&ssl, &conf) != 0) {
+        release_ssl();
+        return false;
+      }
+    } else if (mbedtls_ssl_session_reset(&ssl) != 0) {
+      release_ssl();
+      return false;
+    }
+    if (mbedtls_ssl_set_hostname(&ssl, server) != 0) return false;
+    mbedtls_ssl_set_bio(&ssl, this, bio_send, bio_recv, NULL);
+
+    offered = false;
+    if (have_session && session_server == server_id && mbedtls_ssl_set_session(&ssl, &session) == 0) {
+      offered = true;
+      memcpy(offered_master, session.MQTTT_TLS_FIELD(master), sizeof(offered_master));
+    }
+    return true;
+  }
+
+  void release_ssl() {
+    if (!ssl_ready) return;
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    ssl_ready = false;
+  }
+
+  bool finish_handshake() {
+    int r;
+    while ((r = handshake()) == 0) delay(1);
+    return r > 0;
+  }
+
+  bool wait_fd(bool for_write, uint32_t timeout_ms) {
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    return lwip_select(fd + 1, for_write ? NULL : &set, for_write ? &set : NULL, NULL, &tv) > 0;
+  }
+
+  static int bio_send(void* ctx, const unsigned char* buf, size_t len) {
+    int n = lwip_send(((MqttTlsClient*)ctx)->fd, buf, len, 0);
+    if (n >= 0) return n;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return MBEDTLS_ERR_SSL_WANT_WRITE;
+    return MBEDTLS_ERR_NET_SEND_FAILED;
+  }
+
+  static int bio_recv(void* ctx, unsigned char* buf, size_t len) {
+    int n = lwip_recv(((MqttTlsClient*)ctx)->fd, buf, len, 0);
+    if (n > 0) return n;
+    if (n == 0) return MBEDTLS_ERR_SSL_CONN_EOF;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return MBEDTLS_ERR_SSL_WANT_READ;
+    return MBEDTLS_ERR_NET_RECV_FAILED;
+  }
+
+  static uint32_t server_hash(const char* host, uint16_t port) {
+    uint32_t h = 2166136261u;
+    for (; *host; host++) h = (h ^ (uint8_t)*host) * 16777619u;
+    return (h ^ port) * 16777619u;
+  }
+
+  void save_rtc() {
+    MqttTlsSavedSession& r = mqtt_tls_rtc_session;
+    size_t len = 0;
+    r.magic = 0;
+    session_server = server_id;
+    if (mbedtls_ssl_session_save(&session, r.data, sizeof(r.data), &len) != 0) return;
+    r.server = server_id;
+    r.len = len;
+    r.crc = mqttt_crc32(0, r.data, len);
+    r.magic = SESSION_MAGIC;
+  }
+
+  void load_rtc() {
+    MqttTlsSavedSession& r = mqtt_tls_rtc_session;
+    if (r.magic != SESSION_MAGIC || r.len > sizeof(r.data) || mqttt_crc32(0, r.data, r.len) != r.crc) return;
+    // Fails harmlessly if the firmware's TLS configuration changed since.
+    have_session = mbedtls_ssl_session_load(&session, r.data, r.len) == 0;
+    session_server = r.server;
+  }
+
+  const char* ca_pem = NULL;
+  bool insecure = false;
+  uint32_t handshake_timeout_ms = 10000;
+  uint32_t write_timeout_ms = 5000;
+
+  int fd = -1;
+  uint8_t state = IDLE;
+  char server[128];
+  uint32_t server_id = 0;
+  uint32_t hs_start = 0;
+
+  bool rng_ready = false;
+  bool ssl_ready = false;
+  bool ssl_insecure = false;
+  uint32_t ssl_gen = 0;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context drbg;
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config conf;
+
+  mbedtls_ssl_session session;
+  bool have_session = false;
+  uint32_t session_server = 0;
+  bool offered = false;
+  bool was_resumed = false;
+  uint8_t offered_master[48];
+
+  uint8_t rx[128];
+  uint16_t rx_pos = 0, rx_len = 0;
+
+  Stats st = {};
+};
+
+typedef MqttTlsClient MqttSecureClient;
+
+// The connection state machine's TCP and TLS steps (see connection_MqttT.hpp).
+static bool mqtt_transport_open(MqttTlsClient& c, const char* host, IPAddress ip, uint16_t port,
+                                uint32_t tcp_timeout_ms, uint32_t tls_timeout_ms) {
+  c.setHandshakeTimeout((tls_timeout_ms + 999) / 1000);
+  return c.open(host, ip, port, tcp_timeout_ms);
+}
+static int mqtt_transport_handshake(MqttTlsClient& c) { return c.handshake(); }
+
+#else
+
+typedef WiFiClientSecure MqttSecureClient;
+
+#endif
@@ -0,0 +1,162 @@
+// Topic table for the MQTT templates.
+//
+// Topic (and client id) patterns are expanded once, when the network
+// interface's MAC is known, into strings that then never change.  In a
+// pattern, %s stands for the MAC (12 hex digits, as in "hello_world_%s/hello"),
+// %h for the device's hostname, and %% for a percent sign.
+//
+// Register a pattern once and publish by handle:
+//
+//   MqttTopic hello_topic = mqtt_topics.add("hello_world_%s/hello");
+//   ...
+//   mqttClient.publish(mqtt_topics[hello_topic], value);
+//
+// mqtt_topics[h] is the expanded topic, or the pattern itself before the
+// core has called expand() (in setup(), as soon as the network interface's
+// MAC is known).  withmac(pattern) is add() and lookup in
+// one, for code that has only the pattern; a pattern without a % is
+// returned as it is, without taking a slot.  Strings from either stay valid
+// for good (nothing is formatted into a shared buffer), so any task can use
+// them.
+//
+// Up to MQTTT_TOPICS_MAX patterns fit, with their text in a
+// MQTTT_TOPIC_ARENA-byte arena; nothing is allocated.  add() returns
+// MQTT_NO_TOPIC when full (mqtt_topics[MQTT_NO_TOPIC] is ""), and withmac()
+// then logs the pattern and returns "" rather than a topic with the % still
+// in it.
+//
+// The table only ever grows, and an entry is complete before it's counted,
+// so looking a pattern up takes no lock.  Adding one takes a mutex, once
+// the core has called share() at the start of setup(); before that (global
+// initializers) there's only one task.
+
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#ifndef MQTTT_TOPICS_MAX
+#define MQTTT_TOPICS_MAX 24
+#endif
+#ifndef MQTTT_TOPIC_ARENA
+#define MQTTT_TOPIC_ARENA 1024
+#endif
+
+typedef uint8_t MqttTopic;
+enum { MQTT_NO_TOPIC = 0xFF };
+
+class MqttTopicTable {
+public:
+  // Called by the core before any other task starts.
+  bool share() {
+    if (!lock) lock = xSemaphoreCreateMutex();
+    return lock != NULL;
+  }
+
+  MqttTopic add(const char* pattern) {
+    MqttTopic h = find(pattern, n.load());
+    if (h != MQTT_NO_TOPIC) return h;
+
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+    uint8_t count = n.load();
+    h = find(pattern, count);  // in case another task just added it
+    if (h == MQTT_NO_TOPIC && count < MQTTT_TOPICS_MAX) {
+      size_t mark = used;
+      const char* p = store(pattern, false);
+      const char* t = p && ready && strchr(p, '%') ? store(p, true) : p;
+      if (t) {
+        patterns[count] = p;
+        text[count] = t;
+        n.store(count + 1);  // only now can lookups see it
+        h = count;
+      } else used = mark;  // the expansion didn't fit; give back the pattern's bytes too
+    }
+    if (lock) xSemaphoreGive(lock);
+    if (h == MQTT_NO_TOPIC && !warned) {
+      warned = true;
+      Serial.println("mqtt_topics is full; raise MQTTT_TOPICS_MAX / MQTTT_TOPIC_ARENA");
+    }
+    return h;
+  }
+
+  const char* operator[](MqttTopic h) const { return h < n.load() ? text[h].load() : ""; }
+
+  // The expanded string for pattern, registering it if need be.  Patterns
+  // with nothing to expand come back as they are.
+  const char* intern(const char* pattern) {
+    if (!strchr(pattern, '%')) return pattern;
+    MqttTopic h = add(pattern);
+    if (h == MQTT_NO_TOPIC) Serial.printf("mqtt_topics: no room to expand %s\n", pattern);
+    return (*this)[h];
+  }
+
+  // Called once by the core when the MAC is known.
+  void expand(const uint8_t mac[6], const char* hostname) {
+    if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+    if (!ready) {
+      snprintf(macstr, sizeof(macstr), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+      strlcpy(host, hostname ? hostname : "", sizeof(host));
+      ready = true;
+      for (uint8_t i = 0; i < n.load(); i++) {
+        if (!strchr(patterns[i], '%')) continue;
+        const char* t = store(patterns[i], true);
+        if (t) text[i] = t;
+      }
+    }
+    if (lock) xSemaphoreGive(lock);
+  }
+
+  bool expanded() const { return ready; }
+  size_t count() const { return n.load(); }
+  size_t arena_used() const { return used; }
+
+private:
+  // Searches the first count entries, which never change once counted.
+  MqttTopic find(const char* pattern, uint8_t count) const {
+    for (uint8_t i = 0; i < count; i++)
+      if (patterns[i] == pattern || strcmp(patterns[i], pattern) == 0) return i;
+    return MQTT_NO_TOPIC;
+  }
+
+  // Copies s (expanded, if asked) into the arena; NULL if it doesn't fit.
+  const char* store(const char* s, bool expand) {
+    char* out = arena + used;
+    size_t room = sizeof(arena) - used, len = 0;
+    for (; *s; s++) {
+      const char* piece = s;
+      size_t piece_len = 1;
+      if (expand && s[0] == '%' && s[1]) {
+        s++;
+        if (*s == 's') piece = macstr, piece_len = strlen(macstr);
+        else if (*s == 'h') piece = host, piece_len = strlen(host);
+        else piece = s;  // %% and anything unknown: the character itself
+      }
+      if (len + piece_len >= room) return NULL;
+      memcpy(out + len, piece, piece_len);
+      len += piece_len;
+    }
+    if (len >= room) return NULL;
+    out[len] = 0;
+    used += len + 1;
+    return out;
+  }
+
+  const char* patterns[MQTTT_TOPICS_MAX];
+  std::atomic<const char*> text[MQTTT_TOPICS_MAX];  // the pattern until expand()
+  char arena[MQTTT_TOPIC_ARENA];
+  size_t used = 0;
+  std::atomic<uint8_t> n{0};
+  std::atomic<bool> ready{false};
+  bool warned = false;
+  char macstr[13] = "";
+  char host[64] = "";
+  SemaphoreHandle_t lock = NULL;
+};
+
+MqttTopicTable mqtt_topics;
+
+// Expands %s to the MAC (see above).  Kept for sketches written against
+// earlier versions; the string it returns stays valid and unchanged.
+static const char* withmac(const char* str) { return mqtt_topics.intern(str); }
@@ -0,0 +1,268 @@
+// The WiFi transport for the core (see common_MqttT.hpp): a WiFi station
+// on ssid, WPA2 or WPA2 Enterprise, with the channel scan of
+// wifi_scan_good_rssi and friends below and the reconnect cache of
+// wificache_MqttT.hpp.  It's the default; board headers for Ethernet pick
+// one from eth_MqttT.hpp instead, and none of this gets compiled.
+
+#pragma once
+
+#include <WiFi.h>
+
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+#include <esp_eap_client.h>
+#else
+#include <esp_wpa2.h>
+#endif
+
+#include "wificache_MqttT.hpp"
+
+// WPA2 / WPA2 Enterprise credentials
+extern bool using_WPA2_Enterprise;
+extern const char* ssid;
+extern const char* wifi_username; // Username (applies only to WPA2 Enterprise)
+extern const char* wifi_password; // Password for authentication
+
+// Do scan?
+// recommend true if WiFi might have multiple AP's on same SSID.
+// recommend false if WiFi SSID is likely to be hidden.
+extern bool do_wifi_scan;
+
+// From the core.
+void feed_watchdog();
+void mqtt_identify(const uint8_t* mac);
+extern char mqtt_hostname[];
+bool mqtt_quiet();
+
+bool got_disconnected_event=false;
+
+// WiFi scan tuning.  The scan is a per-channel, early-stop one: it probes
+// only the channels our SSID was last seen on (bit n of wifi_known_channels =
+// channel n), one channel at a time, waiting for each, and stops as soon as
+// an access point at wifi_scan_good_rssi or better turns up.  A sweep of all
+// channels only happens when that finds nothing.
+int32_t wifi_scan_good_rssi = -67;
+uint32_t wifi_scan_ms_per_channel = 120;
+uint16_t wifi_known_channels = 0;
+
+void onWiFiEvent(WiFiEvent_t event) {
+  if (event==ARDUINO_EVENT_WIFI_STA_DISCONNECTED) got_disconnected_event=true;
+  if (event==ARDUINO_EVENT_ETH_DISCONNECTED) got_disconnected_event=true;
+}
+
+// Scans one channel (0 = all of them) for our SSID only, and waits for the
+// result: about wifi_scan_ms_per_channel per channel, so a couple of seconds
+// for a sweep of every channel.  Like the rest of setup_wifi() it blocks;
+// what keeps it short is scanning a channel at a time and stopping early.
+// Returns the number of results.
+static int wifi_scan(uint8_t channel) {
+  feed_watchdog();
+  int16_t n = WiFi.scanNetworks(false, false, false, wifi_scan_ms_per_channel, channel, ssid);
+  feed_watchdog();
+  return n < 0 ? 0 : n;
+}
+
+// Starts associating with our SSID; channel 0 and a NULL bssid let the WiFi
+// library pick.
+static void wifi_begin(int32_t channel, const uint8_t* bssid) {
+  if (using_WPA2_Enterprise) {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+    WiFi.begin(ssid, WPA2_AUTH_PEAP, wifi_username, wifi_username, wifi_password, NULL, NULL, NULL, -1, channel, bssid);
+#else
+    esp_wifi_sta_wpa2_ent_set_identity((uint8_t *)wifi_username, strlen(wifi_username));
+    esp_wifi_sta_wpa2_ent_set_username((uint8_t *)wifi_username, strlen(wifi_username));
+    esp_wifi_sta_wpa2_ent_set_password((uint8_t *)wifi_password, strlen(wifi_password));
+    esp_wifi_sta_wpa2_ent_enable(); 
+    WiFi.begin(ssid, NULL, channel, bssid);
+#endif 
+  } else {
+    WiFi.begin(ssid, wifi_password, channel, bssid);
+  }
+}
+
+// Back to getting our address from DHCP.
+static void wifi_use_dhcp() {
+  WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+}
+
+// Tries the access point (and, if still good, the address) we had last time.
+// See wificache_MqttT.hpp.
+static bool wifi_fast_connect() {
+  MqttWifiCache c;
+  bool from_rtc;
+  if (!mqtt_wifi_cache_load(ssid, c, from_rtc)) return false;
+  if (!wifi_known_channels) wifi_known_channels = c.known_channels;
+
+  bool reuse_lease = from_rtc && mqtt_wifi_lease_valid(c);
+  if (reuse_lease) {
+    WiFi.config(IPAddress(c.ip), IPAddress(c.gateway), IPAddress(c.subnet), IPAddress(c.dns1), IPAddress(c.dns2));
+  }
+  got_disconnected_event=false;
+  wifi_begin(c.channel, c.bssid);
+  uint32_t start = millis();
+  while (WiFi.status() != WL_CONNECTED) {
+    if (got_disconnected_event || millis() - start > wifi_fast_connect_ms) {
+      got_disconnected_event=false;
+      WiFi.disconnect();
+      if (reuse_lease) wifi_use_dhcp();
+      return false;
+    }
+    feed_watchdog();
+    delay(20);
+  }
+  wifi_on_cached_lease = reuse_lease;
+  mqtt_wifi_cache_save(ssid, !reuse_lease, wifi_known_channels);
+  return true;
+}
+
+void setup_wifi() {
+  WiFi.disconnect(true);  // Disconnect any previous WiFi connection
+
+  // The MAC can be read before the station starts, which is when the
+  // hostname has to be set by.
+  uint8_t mac[6];
+  mqtt_identify(WiFi.macAddress(mac));
+  WiFi.setHostname(mqtt_hostname);
+
+  WiFi.mode(WIFI_STA);    // Set WiFi to station mode
+
+  static bool ran_once;
+  if (!ran_once) WiFi.onEvent(onWiFiEvent);
+  ran_once=true;
+
+  // Whatever address a previous attempt configured, start from DHCP.
+  wifi_on_cached_lease = false;
+  wifi_use_dhcp();
+  if (wifi_fast_connect()) {
+    feed_watchdog();
+    return;
+  }
+
+  byte best_bssid[6], second_best_bssid[6];
+  byte* selected_bssid = NULL;
+  int32_t best_rssi = -999, second_best_rssi = -999;
+  int32_t selected_channel=0, second_best_channel=0;
+
+  WiFi.setScanMethod(WIFI_ALL_CHANNEL_SCAN);
+
+  // Consider the SSID for best/secondbest candidacy (assuming encryptionType matches)
+  // Note that if we find nothing (e.g. it's hidden), BSSID will remain null, and the
+  // WiFi library will seek it automatically (without the benefit of best/secondbest)
+  // Returns the channels (as bits) the SSID was heard on.
+  auto consider = [&](int n) -> uint16_t {
+    uint16_t heard = 0;
+    for (int i = 0; i < n; ++i) {
+      if (WiFi.SSID(i)==ssid) {
+        bool ssid_uses_WPA2_Enterprise = (WiFi.encryptionType(i)==WIFI_AUTH_WPA2_ENTERPRISE);
+        if (using_WPA2_Enterprise == ssid_uses_WPA2_Enterprise) {
+          if (WiFi.channel(i) > 0 && WiFi.channel(i) < 16) heard |= 1 << WiFi.channel(i);
+          if (WiFi.RSSI(i) > best_rssi) {
+            // Found a new best -- demote any old one to second-best
+            second_best_rssi = best_rssi, second_best_channel = selected_channel;
+            best_rssi = WiFi.RSSI(i), selected_channel = WiFi.channel(i);
+            byte* bssid = WiFi.BSSID(i);
+            for (int k=0; k<6; k++) second_best_bssid[k]=best_bssid[k], best_bssid[k]= bssid[k];
+            selected_bssid = best_bssid;
+          } else if (WiFi.RSSI(i) > second_best_rssi) {
+            // Found a new second-best
+            second_best_rssi = WiFi.RSSI(i), second_best_channel = WiFi.channel(i);
+            byte* bssid = WiFi.BSSID(i);
+            for (int k=0; k<6; k++) second_best_bssid[k]=bssid[k];
+          }
+        }
+      }
+    }
+    WiFi.scanDelete();
+    return heard;
+  };
+
+  if (do_wifi_scan) {
+    // Where we last heard it first, stopping once we have a strong candidate.
+    uint16_t probed = 0, heard = 0;
+    for (int ch = 1; ch < 16 && best_rssi < wifi_scan_good_rssi; ch++) {
+      if (!(wifi_known_channels & (1 << ch))) continue;
+      probed |= 1 << ch;
+      heard |= consider(wifi_scan(ch));
+    }
+    if (best_rssi == -999) {
+      // Not there (or first time): sweep everything.
+      wifi_known_channels = consider(wifi_scan(0));
+    } else {
+      wifi_known_channels = (wifi_known_channels & ~probed) | heard;
+    }
+    Serial.println("WiFi scan completed.");
+  }
+
+  wifi_begin(selected_channel, selected_bssid);
+
+  int timeoutcounter=30;
+  auto wfs = WiFi.status();
+  static const char* wfs_statuses[] = {"idle","no ssid","scanned","connected","conn fail","conn lost","disconn"};
+	// Serial.print("WiFi status is: ");
+	// ln(wfs_statuses[wfs]);
+
+  while (wfs != WL_CONNECTED) {
+    if (--timeoutcounter < 0) return;
+    if (got_disconnected_event) {
+			// Serial.println("WiFi got disconnected event.");
+    	break;
+    }
+    delay(500);
+    auto new_wfs = WiFi.status();
+    if (new_wfs != wfs) {
+    	// Serial.print("WiFi status is now: ");
+    	// Serial.println(wfs_statuses[new_wfs]);
+    }
+    wfs = new_wfs;
+  }
+  got_disconnected_event=false;
+  if (WiFi.status() != WL_CONNECTED && second_best_rssi != -999) {
+    // Trying alternate (if one identified), or just trying via esp selection (if none)
+    selected_bssid = NULL, selected_channel=0;
+    if (second_best_rssi != -999) selected_bssid = second_best_bssid, selected_channel=second_best_channel;
+    wifi_begin(selected_channel, selected_bssid);
+    timeoutcounter = 30;
+    wfs = WiFi.status();
+    while (wfs != WL_CONNECTED) {
+      if (--timeoutcounter < 0) return;
+      if (got_disconnected_event) return;
+      delay(500);
+      wfs = WiFi.status();
+    }
+  }
+
+  mqtt_wifi_cache_save(ssid, true, wifi_known_channels);
+  feed_watchdog(); // feed watchdog timer
+
+  // Serial.print("WiFi connected, local IP ");
+  // Serial.println(WiFi.localIP());
+
+}
+
+struct MqttWifi {
+  static void begin() { setup_wifi(); }
+
+  static bool up() {
+    if (WiFi.status() != WL_CONNECTED) return false;
+    if (wifi_on_cached_lease && !mqtt_wifi_lease_valid(mqtt_wifi_rtc_cache)) {
+      // We skipped DHCP on the strength of a cached lease that has now run
+      // out.  Reconnecting through DHCP takes the MQTT session down too, so
+      // wait for a quiet moment, but not for long (see wificache_MqttT.hpp).
+      static bool waiting;
+      static uint32_t expired_at;
+      if (!waiting) waiting = true, expired_at = millis();
+      if (!mqtt_quiet() && millis() - expired_at < wifi_lease_renew_wait_ms) return true;
+      waiting = false;
+      Serial.println("WiFi: cached lease ran out; reconnecting through DHCP");
+      mqtt_wifi_cache_drop_lease();
+      wifi_on_cached_lease = false;
+      WiFi.disconnect();
+      return false;
+    }
+    return true;
+  }
+
+  static bool reconnect() {
+    setup_wifi();
+    return WiFi.status() == WL_CONNECTED;
+  }
+};
@@ -0,0 +1,133 @@
+// Remembers how the last WiFi connection was made, for a fast reconnect.
+//
+// After each successful connect, setup_wifi() saves the access point (BSSID
+// and channel), the channels the SSID has been seen on, and the DHCP lease
+// (IP, gateway, subnet, DNS).  The next setup_wifi() -- including the first
+// one after a watchdog reset, esp_restart() or deep sleep -- first tries to
+// associate straight to that access point and, while the lease is still
+// good, to use the same address without asking DHCP.  Only if that doesn't
+// connect within wifi_fast_connect_ms does it fall back to scanning.
+//
+// The copy in RTC memory survives everything but a power cycle.  A copy in
+// NVS (flash) covers power cycles too, but there's no telling how long the
+// device was off, so after a power cycle the lease isn't reused (the access
+// point still is).  NVS is only written when something in it changed.
+//
+// DHCP doesn't tell us the lease length, so a lease is trusted for
+// wifi_lease_cache_s after it was obtained; keep that well inside the
+// network's real lease.  When it runs out while we're using it, the address
+// mustn't be kept (the DHCP server may give it to someone else), so the
+// link is reconnected through DHCP: at the first moment nothing is queued or
+// waiting for a PUBACK, and at the latest wifi_lease_renew_wait_ms later.
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <time.h>
+
+// Tunable from the sketch.
+uint32_t wifi_fast_connect_ms = 3000;
+uint32_t wifi_lease_cache_s = 3600;
+uint32_t wifi_lease_renew_wait_ms = 300000;
+bool wifi_use_cache = true;
+
+struct MqttWifiCache {
+  uint32_t magic;
+  uint32_t ssid_hash;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t have_lease;
+  uint16_t known_channels;  // see wifi_known_channels
+  uint16_t reserved;
+  uint32_t ip, gateway, subnet, dns1, dns2;
+  uint32_t lease_expires;  // time(), which keeps counting through resets and deep sleep
+  uint32_t crc;
+};
+
+RTC_NOINIT_ATTR MqttWifiCache mqtt_wifi_rtc_cache;
+
+// The lease in the cache was loaded from RTC memory (so its expiry means
+// something) and we are connected using it.
+bool wifi_on_cached_lease = false;
+
+static uint32_t mqtt_wifi_cache_crc(const MqttWifiCache& c) {
+  uint32_t h = 2166136261u;
+  const uint8_t* p = (const uint8_t*)&c;
+  for (size_t i = 0; i < offsetof(MqttWifiCache, crc); i++) h = (h ^ p[i]) * 16777619u;
+  return h;
+}
+
+static uint32_t mqtt_wifi_ssid_hash(const char* ssid) {
+  uint32_t h = 2166136261u;
+  for (; *ssid; ssid++) h = (h ^ (uint8_t)*ssid) * 16777619u;
+  return h;
+}
+
+enum { MQTT_WIFI_CACHE_MAGIC = 0x4D574643 };
+
+// Fills c from RTC memory, or failing that from NVS.  from_rtc says which;
+// a lease from NVS must not be trusted.
+static bool mqtt_wifi_cache_load(const char* ssid, MqttWifiCache& c, bool& from_rtc) {
+  if (!wifi_use_cache) return false;
+  uint32_t want = mqtt_wifi_ssid_hash(ssid);
+  c = mqtt_wifi_rtc_cache;
+  from_rtc = true;
+  if (c.magic == MQTT_WIFI_CACHE_MAGIC && c.crc == mqtt_wifi_cache_crc(c) && c.ssid_hash == want) return true;
+
+  from_rtc = false;
+  Preferences nvs;
+  if (!nvs.begin("mqttt", true)) return false;
+  size_t n = nvs.getBytes("wifi", &c, sizeof(c));
+  nvs.end();
+  return n == sizeof(c) && c.magic == MQTT_WIFI_CACHE_MAGIC && c.crc == mqtt_wifi_cache_crc(c) &&
+         c.ssid_hash == want;
+}
+
+// Records the connection we're on.  If the address came from DHCP it's
+// remembered as a fresh lease; if we're on a cached lease, that lease's
+// expiry is kept.
+static void mqtt_wifi_cache_save(const char* ssid, bool fresh_lease, uint16_t known_channels) {
+  if (!wifi_use_cache) return;
+  MqttWifiCache c;
+  memset(&c, 0, sizeof(c));
+  c.magic = MQTT_WIFI_CACHE_MAGIC;
+  c.ssid_hash = mqtt_wifi_ssid_hash(ssid);
+  memcpy(c.bssid, WiFi.BSSID(), 6);
+  c.channel = WiFi.channel();
+  c.known_channels = known_channels;
+  c.ip = WiFi.localIP();
+  c.gateway = WiFi.gatewayIP();
+  c.subnet = WiFi.subnetMask();
+  c.dns1 = WiFi.dnsIP(0);
+  c.dns2 = WiFi.dnsIP(1);
+  c.have_lease = 1;
+  if (fresh_lease) c.lease_expires = (uint32_t)time(NULL) + wifi_lease_cache_s;
+  else c.lease_expires = mqtt_wifi_rtc_cache.lease_expires;
+  c.crc = mqtt_wifi_cache_crc(c);
+  mqtt_wifi_rtc_cache = c;
+
+  // NVS only when something other than the lease expiry changed, to spare
+  // the flash.
+  Preferences nvs;
+  if (!nvs.begin("mqttt", false)) return;
+  MqttWifiCache old;
+  size_t n = nvs.getBytes("wifi", &old, sizeof(old));
+  old.lease_expires = c.lease_expires;
+  old.crc = c.crc;
+  if (n != sizeof(old) || memcmp(&old, &c, sizeof(c)) != 0) nvs.putBytes("wifi", &c, sizeof(c));
+  nvs.end();
+}
+
+// Forgets the lease (but not the access point), e.g. when it has run out.
+static void mqtt_wifi_cache_drop_lease() {
+  MqttWifiCache& c = mqtt_wifi_rtc_cache;
+  if (c.magic != MQTT_WIFI_CACHE_MAGIC || c.crc != mqtt_wifi_cache_crc(c)) return;
+  c.have_lease = 0;
+  c.crc = mqtt_wifi_cache_crc(c);
+}
+
+static bool mqtt_wifi_lease_valid(const MqttWifiCache& c) {
+  return c.have_lease && c.ip != 0 && (int32_t)(c.lease_expires - (uint32_t)time(NULL)) > 0;
+}
@@ -0,0 +1,164 @@
+// The Client PubSubClient talks through.
+//
+// MqttWire sits between PubSubClient and the real transport (espClient) and
+// passes everything through, watching the packets coming in as it goes.
+// That lets the library see what PubSubClient ignores: PUBACKs (for
+// mqtt_qos1) and each CONNACK, which starts a new session.  It also gives
+// the library a way to send whole packets of its own, between PubSubClient's
+// calls, on the same connection.  With mqtt5_enabled, it also translates
+// each connection to and from MQTT 5 (see mqtt5_MqttT.hpp).
+//
+// The core sets it up; sketches don't need to touch it:
+//
+//   MqttWire mqtt_wire(espClient);
+//   PubSubClient mqttClient(mqtt_wire);
+
+#pragma once
+
+#include <Arduino.h>
+#include <Client.h>
+#include "mqtt5_MqttT.hpp"
+
+#ifndef MQTTT_WIRE_ACKS
+#define MQTTT_WIRE_ACKS 32
+#endif
+
+class MqttWire : public Client {
+  static_assert((MQTTT_WIRE_ACKS & (MQTTT_WIRE_ACKS - 1)) == 0, "MQTTT_WIRE_ACKS must be a power of two");
+
+public:
+  explicit MqttWire(Client& net) : net(net) {}
+
+  int connect(IPAddress ip, uint16_t port) {
+    reset();
+    return net.connect(ip, port);
+  }
+  int connect(const char* host, uint16_t port) {
+    reset();
+    return net.connect(host, port);
+  }
+  // Newer cores add these to Client.  PubSubClient only connects a transport
+  // that isn't connected yet, and the connection state machine always has.
+  int connect(IPAddress ip, uint16_t port, int32_t) { return connect(ip, port); }
+  int connect(const char* host, uint16_t port, int32_t) { return connect(host, port); }
+  size_t write(uint8_t b) { return write(&b, 1); }
+  void flush() { net.flush(); }
+  operator bool() { return (bool)net; }
+
+  size_t write(const uint8_t* buf, size_t size) {
+    if (fresh && size) {
+      // The first packet on a connection is CONNECT: MQTT 5 or not is
+      // decided for the whole connection here.
+      fresh = false;
+      if (!(mqtt5_enabled && buf[0] == 0x10 && mqtt5.begin())) mqtt5.end();
+    }
+    return mqtt5.active() ? mqtt5.send(net, buf, size) : net.write(buf, size);
+  }
+
+  int available() { return mqtt5.active() ? mqtt5.available(net) : net.available(); }
+  int peek() { return mqtt5.active() ? mqtt5.peek(net) : net.peek(); }
+
+  int read() {
+    int b = mqtt5.active() ? mqtt5.read(net) : net.read();
+    if (b >= 0) sniff((uint8_t)b);
+    return b;
+  }
+
+  int read(uint8_t* buf, size_t size) {
+    int n = 0;
+    if (!mqtt5.active()) n = net.read(buf, size);
+    else
+      for (int b; n < (int)size && (b = mqtt5.read(net)) >= 0;) buf[n++] = b;
+    for (int i = 0; i < n; i++) sniff(buf[i]);
+    return n;
+  }
+
+  void stop() {
+    net.stop();
+    reset();
+  }
+
+  // Whatever was half read belongs to a connection that's gone.
+  uint8_t connected() {
+    uint8_t c = net.connected();
+    if (!c) reset();
+    return c;
+  }
+
+  // Counts CONNACKs: changes each time a new session starts.
+  uint32_t sessions() const { return n_sessions; }
+
+  // Whether the last CONNACK said the broker still had this client's
+  // session (only with MQTT 5; a 3.1.1 connection always starts clean).
+  bool session_present() const { return present; }
+
+  // Whether this connection is MQTT 5.
+  bool mqtt5_active() const { return mqtt5.active(); }
+
+  // MQTT 5 PUBACKs that refused a message (see mqtt5_MqttT.hpp).
+  uint32_t mqtt5_rejected() const { return mqtt5.rejected(); }
+
+  // Packet ids of PUBACKs received, oldest first, with reason 0; then
+  // those an MQTT 5 broker refused, with its reason code.
+  bool take_ack(uint16_t& id, uint8_t& reason) {
+    if (ack_head == ack_tail) return mqtt5.take_refusal(id, reason);
+    id = acks[ack_tail++ % MQTTT_WIRE_ACKS];
+    reason = 0;
+    return true;
+  }
+
+private:
+  enum { HEADER, LENGTH, BODY };
+
+  // Follows the incoming byte stream a packet at a time: fixed header,
+  // remaining length (a varint), then the body, of which only the first
+  // two bytes (the packet id, for acks) are kept.
+  void sniff(uint8_t b) {
+    switch (part) {
+      case HEADER:
+        type = b >> 4;
+        remaining = 0;
+        shift = 0;
+        part = LENGTH;
+        break;
+      case LENGTH:
+        remaining |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+        if (!(b & 0x80)) {
+          got = 0;
+          if (remaining) part = BODY;
+          else packet_done();
+        } else if (shift > 21) part = HEADER;
+        break;
+      case BODY:
+        if (got < 2) head[got] = b;
+        if (++got == remaining) packet_done();
+        break;
+    }
+  }
+
+  void packet_done() {
+    part = HEADER;
+    if (type == 2) {  // CONNACK
+      n_sessions++;
+      present = remaining >= 1 && (head[0] & 1);
+    }
+    else if (type == 4 && remaining >= 2 && ack_head - ack_tail < MQTTT_WIRE_ACKS)  // PUBACK
+      acks[ack_head++ % MQTTT_WIRE_ACKS] = (uint16_t)(head[0] << 8 | head[1]);
+  }
+
+  void reset() {
+    part = HEADER;
+    fresh = true;
+  }
+
+  Client& net;
+  Mqtt5Codec mqtt5;
+  bool fresh = true, present = false;
+  uint8_t part = HEADER, type = 0, shift = 0;
+  uint32_t remaining = 0, got = 0;
+  uint8_t head[2];
+  uint32_t n_sessions = 0;
+  uint16_t acks[MQTTT_WIRE_ACKS];
+  uint32_t ack_head = 0, ack_tail = 0;
+};